@@ -9,9 +9,9 @@
 #include <linux/cache.h>
 #include <linux/net.h>
 #include <linux/inet.h>
-#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/wait.h>
+#include <linux/wait_bit.h>
 #include <linux/sched.h>
 
 #define CONFIG_CACHEOBJS_CONNHASH
@@ -21,17 +21,13 @@
 #include "stat.h"
 
 /*
- * Ref : https://www.kfki.hu/~kadlec/sw/netfilter/ct3/
- *
- * We can probably replace this with murmash hash which takes lesser
- * cpu cyles. But could not find an existing kernel implementation.
+ * key hash of the table, selected by its owner (conntable_hash.h)
  */
-static inline u32 hashfn(__be32 daddr, __be32 port)
+static inline u32 hashfn(struct cacheobj_conntable *table, __be32 daddr,
+	__be32 port)
 {
-	static u32 hash_seed __read_mostly;
-
-	net_get_random_once(&hash_seed, sizeof(hash_seed));
-	return jhash_2words((__force u32) daddr, (__force u32) port, hash_seed);
+	return conntable_hash_2words(&table->hash, (__force u32) daddr,
+		(__force u32) port);
 }
 
 /*
@@ -42,12 +38,13 @@ static inline u32 hashfn(__be32 daddr, __be32 port)
  *
  * TBD   : perform ip conversion outside of core table operations
  */
-static inline int ipv4_hash32(const unsigned char *ip, unsigned int port, u32 *key)
+static inline int ipv4_hash32(struct cacheobj_conntable *table,
+	const unsigned char *ip, unsigned int port, u32 *key)
 {
 	__be32 daddr = 0;
 
 	if (ip && (in4_pton(ip, strlen(ip), (u8 *)&daddr, '\0', NULL) == 1)) {
-		*key = hashfn(daddr, (__be32) port);
+		*key = hashfn(table, daddr, (__be32) port);
 		return 0;
 	} else {
 		pr_err("ipv4_hash32 error: null or invalid ip-tuple\n");
@@ -91,6 +88,21 @@ void cacheobj_connection_node_update_ktime(struct cacheobj_connection_node *conn
         }
 }
 
+/*
+ * wake getters waiting for a connection of a node to become ready, var is
+ * the wait_var of the node read while it was locked. the connection var
+ * names may be gone once unlocked, which is fine as wake_up_var only hashes
+ * the address.
+ */
+static inline void __connection_wake(void *var)
+{
+	if (var) {
+		// pairs with the state check of a getter about to sleep
+		smp_mb();
+		wake_up_var(var);
+	}
+}
+
 /*
  * connection node initialization
  */
@@ -106,6 +118,7 @@ inline int cacheobj_connection_node_init(struct cacheobj_connection_node *connp,
 	connp->port = port;
 	mutex_init(&connp->lock);
 	INIT_HLIST_NODE(&connp->hentry);
+	connp->wait_var = NULL;
         cacheobj_connection_node_reset_stats(connp);
 	return 0;
 }
@@ -136,6 +149,8 @@ int cacheobj_connection_node_destroy(struct cacheobj_connection_node *connp)
 inline
 void cacheobj_connection_node_failed(struct cacheobj_connection_node *connp)
 {
+	void *var = READ_ONCE(connp->wait_var);
+
 	// resource must be locked
 	if (connp->state == CONN_ACTIVE) {
 		CONNTBL_ASSERT(mutex_is_locked(&connp->lock));
@@ -147,6 +162,8 @@ void cacheobj_connection_node_failed(struct cacheobj_connection_node *connp)
 		connp->state = CONN_FAILED;
 		mutex_unlock(&connp->lock);
 	}
+	// getters may find all paths down now
+	__connection_wake(var);
 }
 
 /*
@@ -165,10 +182,14 @@ void cacheobj_connection_node_retry(struct cacheobj_connection_node *connp)
 inline
 void cacheobj_connection_node_ready(struct cacheobj_connection_node *connp)
 {
+	void *var;
+
 	if (connp->state == CONN_RETRY) {
 		CONNTBL_ASSERT(mutex_is_locked(&connp->lock));
 		connp->state = CONN_READY;
+		var = READ_ONCE(connp->wait_var);
 		mutex_unlock(&connp->lock);
+		__connection_wake(var);
 	}
 }
 
@@ -177,17 +198,52 @@ void cacheobj_connection_node_ready(struct cacheobj_connection_node *connp)
  */
 static int cacheobj_connection_hashtable_init(struct cacheobj_conntable* table)
 {
+	int err;
+
+	err = conntable_hash_seed(&table->hash);
+	if (err) {
+		pr_err("conntable hash %d unknown\n", table->hash.fn);
+		return err;
+	}
+	err = conntable_probe_stats_init(table);
+	if (err) {
+		pr_err("conntable probe stats alloc failed\n");
+		return err;
+	}
 	hash_init(table->buckets);
 	rwlock_init(&table->lock);
 	return 0;
 }
 
+/*
+ * getters of a node sleep on its wait_var, so a put wakes only getters of
+ * that ip:port and not the rest of the bucket. the var is the address of
+ * the first connection the node had, passed on to every connection inserted
+ * while the node has one left.
+ * note: caller must have table lock
+ */
+static inline void *__connection_wait_var(struct cacheobj_conntable *table,
+	const char *ip, unsigned int port, u32 key)
+{
+	struct cacheobj_connection_node *connp;
+
+	hash_for_each_possible(table->buckets, connp, hentry, key) {
+		if ((connp->port == port) && (strcmp(connp->ip, ip) == 0))
+			return connp->wait_var;
+	}
+	return NULL;
+}
+
 /*
  * insert entry in table, not protected
  */
 static inline void __connection_insert(struct cacheobj_conntable *table,
         struct cacheobj_connection_node *connp, u32 key)
 {
+	connp->wait_var = __connection_wait_var(table, connp->ip, connp->port,
+		key);
+	if (!connp->wait_var)
+		connp->wait_var = connp;
 	hash_add(table->buckets, &connp->hentry, key);
 }
 
@@ -198,14 +254,17 @@ static int cacheobj_connection_hashtable_insert(struct cacheobj_conntable *table
 	struct cacheobj_connection_node *connp)
 {
 	u32 key = 0;
+	void *var;
 
-	if (ipv4_hash32(connp->ip, connp->port, &key) < 0)
+	if (ipv4_hash32(table, connp->ip, connp->port, &key) < 0)
 		return -EINVAL;
 
 	write_lock(&table->lock);
 	connp->state = CONN_READY;
 	__connection_insert(table, connp, key);
+	var = connp->wait_var;
 	write_unlock(&table->lock);
+	__connection_wake(var);
 	return 0;
 }
 
@@ -244,10 +303,17 @@ static int cacheobj_connection_hashtable_remove(struct cacheobj_conntable *table
         struct cacheobj_connection_node *connp)
 {
 	int err;
+	void *var = NULL;
 
 	write_lock(&table->lock);
 	err = __connection_remove(table, connp);
+	if (!err) {
+		var = connp->wait_var;
+		connp->wait_var = NULL;
+	}
 	write_unlock(&table->lock);
+	// getters may find the node gone now
+	__connection_wake(var);
 	return err;
 }
 
@@ -259,20 +325,24 @@ static struct cacheobj_connection_node *cacheobj_connection_hashtable_lookup
     (struct cacheobj_conntable *table, const char *ip, unsigned int port)
 {
 	u32 key = 0;
+	unsigned int probes = 0;
 	struct cacheobj_connection_node *connp = NULL;
 	struct hlist_node *tmp;
 
-	if (ipv4_hash32(ip, port, &key) < 0)
+	if (ipv4_hash32(table, ip, port, &key) < 0)
 		return ERR_PTR(-EINVAL);
 
 	read_lock(&table->lock);
 	hash_for_each_possible_safe(table->buckets, connp, tmp, hentry, key) {
+		probes++;
 		if ((connp->port == port) && (strcmp(connp->ip, ip) == 0)) {
 			read_unlock(&table->lock);
+			conntable_probe_record(table, probes);
 			return connp;
 		}
 	}
 	read_unlock(&table->lock);
+	conntable_probe_record(table, probes);
 	return NULL;
 }
 
@@ -297,34 +367,45 @@ static struct cacheobj_connection_node *cacheobj_connection_hashtable_iter
 }
 
 /*
- * finds a ready connection for a node, protected
+ * account a grabbed connection, wait ends and use starts
+ */
+static inline void __connection_got(struct cacheobj_connection_node *connp,
+	ktime_t now_ns)
+{
+	// end wait time
+	cacheobjects_stat64_add(ktime_ns_delta(ktime_get(), now_ns),
+		&connp->cum_wait_ns);
+	// start use time
+	cacheobjects_stat64_ktime(&connp->now_ns);
+	cacheobjects_stat64(&connp->nr_lookups);
+}
+
+/*
+ * legacy slow path (CONNTABLE_LEGACY_SLOWPATH), kept to benchmark against:
+ * sleeps on the mutex of the first busy connection of the node while still
+ * holding the table read lock, so getters serialize behind that connection
+ * even once another is ready.
  * returns :
  * 	locked connection on success
  *	NULL on new node
- *	-EINVAL on bad input
  *	-EPIPE on all paths down
  */
-static struct cacheobj_connection_node* connection_get(struct cacheobj_conntable
-        *table, const char *ip, unsigned int port)
+static struct cacheobj_connection_node* __connection_get_legacy
+	(struct cacheobj_conntable *table, const char *ip, unsigned int port,
+	u32 key, ktime_t now_ns)
 {
-	u32 key = 0;
-#ifdef CONFIG_CACHEOBJS_STATS
-	ktime_t now_ns;
-#endif
+	unsigned int probes;
 	struct cacheobj_connection_node *connp;
 	bool present = false, slow_path = false, apd;
 
-	if (ipv4_hash32(ip, port, &key) < 0)
-		return ERR_PTR(-EINVAL);
-
-	// start wait time
-	cacheobjects_stat64_ktime(&now_ns);
 	read_lock(&table->lock);
 
 	do {
 		struct hlist_node *tmp = NULL;
 		apd = true;
+		probes = 0;
 		hash_for_each_possible_safe(table->buckets, connp, tmp, hentry, key) {
+			probes++;
 			if ((connp->port != port) || (strcmp(connp->ip, ip) != 0))
 				continue;
 
@@ -346,18 +427,15 @@ static struct cacheobj_connection_node* connection_get(struct cacheobj_conntable
 			if (connp->state == CONN_READY) {
 				connp->state = CONN_ACTIVE;
 				read_unlock(&table->lock);
-				// end wait time
-				cacheobjects_stat64_add(ktime_ns_delta
-				     (ktime_get(), now_ns), &connp->cum_wait_ns);
-				// start use time
-				cacheobjects_stat64_ktime(&connp->now_ns);
-				cacheobjects_stat64(&connp->nr_lookups);
+				conntable_probe_record(table, probes);
+				__connection_got(connp, now_ns);
 				return connp;
 			} else {
 				mutex_unlock(&connp->lock);
 			}
 		}
 
+		conntable_probe_record(table, probes);
 		if (!slow_path)
 			slow_path = true;
 
@@ -375,19 +453,155 @@ static struct cacheobj_connection_node* connection_get(struct cacheobj_conntable
 }
 
 /*
- *	timed version is now a plain dfc get (untimed). if we add
- *	waitqueue based implementation, we can update this function (TBD)
+ * one pass over the connections of a node, grabbing the first ready one
+ * without sleeping. *busy is set if a connection is held by someone else,
+ * so one may still become ready, and *var to the wait_var of the node.
+ * note: caller must have table read lock
+ */
+static struct cacheobj_connection_node* __connection_try_get
+	(struct cacheobj_conntable *table, const char *ip, unsigned int port,
+	u32 key, bool *present, bool *busy, void **var)
+{
+	unsigned int probes = 0;
+	struct cacheobj_connection_node *connp;
+
+	*present = *busy = false;
+	*var = NULL;
+	hash_for_each_possible(table->buckets, connp, hentry, key) {
+		probes++;
+		if ((connp->port != port) || (strcmp(connp->ip, ip) != 0))
+			continue;
+
+		*present = true;
+		*var = connp->wait_var;
+		if (!mutex_trylock(&connp->lock)) {
+			*busy = true;
+			continue;
+		}
+		if (connp->state == CONN_READY) {
+			connp->state = CONN_ACTIVE;
+			conntable_probe_record(table, probes);
+			return connp;
+		}
+		mutex_unlock(&connp->lock);
+	}
+	conntable_probe_record(table, probes);
+	return NULL;
+}
+
+/*
+ * wake condition of a getter sleeping on wait: a connection was grabbed,
+ * there is nothing left to wait for, or the node was emptied and refilled
+ * under another var
+ */
+static bool __connection_get_done(struct cacheobj_conntable *table,
+	const char *ip, unsigned int port, u32 key, void *wait,
+	struct cacheobj_connection_node **connp, bool *present, bool *busy,
+	void **var)
+{
+	read_lock(&table->lock);
+	*connp = __connection_try_get(table, ip, port, key, present, busy, var);
+	read_unlock(&table->lock);
+	return *connp || !*busy || (*var != wait);
+}
+
+/*
+ * finds a ready connection for a node, protected
+ * -getters with none ready sleep on the wait_var of the node, with no table
+ *  lock held, and take whichever connection of the node is put, made ready
+ *  or inserted first
+ * -timeout (jiffies) of 0 or less waits until a connection is had, as get
+ *  did before it was timed
+ * returns :
+ * 	locked connection on success
+ *	NULL on new node
+ *	-EINVAL on bad input
+ *	-ETIME on timeout (jiffies)
+ *	-EPIPE on all paths down
+ */
+static struct cacheobj_connection_node* connection_get(struct cacheobj_conntable
+        *table, const char *ip, unsigned int port, long timeout)
+{
+	u32 key = 0;
+	ktime_t now_ns = 0;
+	struct cacheobj_connection_node *connp;
+	void *var, *wait;
+	bool present, busy, slow_path = false;
+
+	if (ipv4_hash32(table, ip, port, &key) < 0)
+		return ERR_PTR(-EINVAL);
+	if (timeout <= 0)
+		timeout = MAX_SCHEDULE_TIMEOUT;
+
+	// start wait time
+	cacheobjects_stat64_ktime(&now_ns);
+	if (table->flags & CONNTABLE_LEGACY_SLOWPATH)
+		return __connection_get_legacy(table, ip, port, key, now_ns);
+
+	// first pass finds the var of the node, in case it is busy
+	__connection_get_done(table, ip, port, key, NULL, &connp, &present, &busy,
+		&var);
+	while (!connp && busy) {
+		slow_path = true;
+		wait = var;
+		timeout = wait_var_event_timeout(wait, __connection_get_done(table,
+			ip, port, key, wait, &connp, &present, &busy, &var), timeout);
+		if (!timeout)
+			return ERR_PTR(-ETIME);
+	}
+
+	if (connp) {
+		if (slow_path)
+			cacheobjects_stat64(&connp->nr_slow_paths);
+		__connection_got(connp, now_ns);
+		return connp;
+	}
+
+	if (!present) {
+		pr_info("get connection failed, node not present in table");
+		return NULL;
+	}
+
+	pr_err("get connection failed, all paths down to node!");
+	return ERR_PTR(-EPIPE);
+}
+
+/*
+ *	timeout is ignored with CONNTABLE_LEGACY_SLOWPATH
  */
 static struct cacheobj_connection_node* cacheobj_connection_timed_get
         (struct cacheobj_conntable *table, const char *ip, unsigned int port,
         long timeout)
 {
-	return connection_get(table, ip, port);
+	return connection_get(table, ip, port, timeout);
+}
+
+/*
+ *	leases are not tracked in this version, same as a timed get
+ */
+static struct cacheobj_connection_node* cacheobj_connection_leased_get
+        (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+        long timeout, unsigned long lease)
+{
+	return connection_get(table, ip, port, timeout);
+}
+
+/*
+ *	byte accounting only, no rate limits in this version
+ */
+static int cacheobj_connection_account(struct cacheobj_conntable *table,
+	struct cacheobj_connection_node *connp, size_t tx, size_t rx)
+{
+	cacheobjects_stat64_add(tx, &connp->tx_bytes);
+	cacheobjects_stat64_add(rx, &connp->rx_bytes);
+	return 0;
 }
 
 static void cacheobj_connection_put(struct cacheobj_conntable *table,
 	struct cacheobj_connection_node *connp, conn_op_t op)
 {
+	void *var;
+
 	if (!mutex_is_locked(&connp->lock))
 		pr_err("Mutex not locked for connection %p. Stat=%d",
 			connp, connp->state);
@@ -399,7 +613,9 @@ static void cacheobj_connection_put(struct cacheobj_conntable *table,
 		cacheobj_connection_node_update_ktime(connp, op);
 		connp->state = CONN_READY;
 	}
+	var = READ_ONCE(connp->wait_var);
 	mutex_unlock(&connp->lock);
+	__connection_wake(var);
 }
 
 /*
@@ -432,6 +648,30 @@ exit:
 	return err;
 }
 
+/*
+ * free what init set up, once the table is destroyed and no op can run.
+ * lookups record probes after dropping the table lock, so a clear must
+ * leave the probe stats alone.
+ */
+static void cacheobj_connection_hashtable_exit(struct cacheobj_conntable *table)
+{
+	conntable_probe_stats_exit(table);
+}
+
+/*
+ * bucket chain lengths and lookup probes, chains copied out under the lock
+ */
+static void cacheobj_connection_hashtable_bucket_dump(struct cacheobj_conntable
+	*table, struct seq_file *m)
+{
+	unsigned int chain[MAX_BUCKETS];
+
+	read_lock(&table->lock);
+	conntable_bucket_chains(table, chain);
+	read_unlock(&table->lock);
+	conntable_bucket_report(table, chain, m);
+}
+
 /*
  * track connection distribution, protected
  */
@@ -478,11 +718,15 @@ const struct cacheobj_conntable_operations cacheobj_conntable_ops =
 {
     .cacheobj_conntable_init = cacheobj_connection_hashtable_init,
     .cacheobj_conntable_destroy = cacheobj_connection_hashtable_destroy,
+    .cacheobj_conntable_exit = cacheobj_connection_hashtable_exit,
     .cacheobj_conntable_insert = cacheobj_connection_hashtable_insert,
     .cacheobj_conntable_remove = cacheobj_connection_hashtable_remove,
     .cacheobj_conntable_lookup = cacheobj_connection_hashtable_lookup,
     .cacheobj_conntable_iter = cacheobj_connection_hashtable_iter,
     .cacheobj_conntable_timed_get = cacheobj_connection_timed_get,
+    .cacheobj_conntable_leased_get = cacheobj_connection_leased_get,
     .cacheobj_conntable_put = cacheobj_connection_put,
-    .cacheobj_conntable_dump = cacheobj_connection_hashtable_dump
+    .cacheobj_conntable_account = cacheobj_connection_account,
+    .cacheobj_conntable_dump = cacheobj_connection_hashtable_dump,
+    .cacheobj_conntable_bucket_dump = cacheobj_connection_hashtable_bucket_dump
 };
@@ -12,6 +12,14 @@
 #include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/sort.h>
+#include <linux/mm.h>
+#include <linux/mempool.h>
+#include <linux/sched/clock.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
 
 #ifndef CONFIG_CACHEOBJS_CONNPOOL
 #define CONFIG_CACHEOBJS_CONNPOOL
@@ -28,18 +36,57 @@
 #define POOL_FMT "<%s:%u>"
 #define POOL_ARGS(pool) pool->ip, pool->port
 
+#ifdef CONFIG_CACHEOBJS_STATS
+#define CONN_TRACE(table, op, connp, from, to, wait_ns, hold_ns) \
+    conntrace_record(&(table)->trace, op, (connp)->ip, (connp)->port, \
+        connp, from, to, wait_ns, hold_ns)
+#else
+#define CONN_TRACE(table, op, connp, from, to, wait_ns, hold_ns) \
+    do { } while (0)
+#endif
+
+/* connections counted for the pool state of a slow operation */
+#define OUTLIER_SCAN_MAX 4096
+
+/* timeout of a non-sleeping get */
+#define GET_NOWAIT (-1L)
+
 /*
- * Ref : https://www.kfki.hu/~kadlec/sw/netfilter/ct3/
- *
- * We can probably replace this with murmash hash which takes lesser
- * cpu cyles. But could not find an existing kernel implementation.
+ * hand-off slot of a parked getter, claimed once with cmpxchg by the first
+ * put to serve it. a hedged getter shares one claim across two pools.
+ * lives on the getter stack, puts only touch it under a pool wait_lock.
  */
-static inline u32 hashfn(__be32 daddr, __be32 port)
-{
-    static u32 hash_seed __read_mostly;
+struct cacheobj_connection_claim {
+    struct task_struct              *task;
+    struct cacheobj_connection_node *connp; // set on hand-off
+    struct cacheobj_connection_pool *pool;  // pool which handed off
+    ktime_t                         handoff_ns;
+};
+
+/* claimed by the getter itself, after taking a semaphore count elsewhere */
+#define CLAIM_TAKEN ((struct cacheobj_connection_node *) 1UL)
 
-    net_get_random_once(&hash_seed, sizeof(hash_seed));
-    return jhash_2words((__force u32) daddr, (__force u32) port, hash_seed);
+/* getter parked on one pool wait list */
+struct cacheobj_connection_waiter {
+    struct list_head                list;
+    struct cacheobj_connection_claim *claim;
+};
+
+/* secondary pool of a hedged get */
+struct conn_hedge {
+    const char      *ip;
+    unsigned int    port;
+    long            after; // jiffies before hedging, 0 for pool p95 wait
+};
+
+/*
+ * key hash of the table, selected by its owner (conntable_hash.h)
+ */
+static inline u32 hashfn(struct cacheobj_conntable *table, __be32 daddr,
+    __be32 port)
+{
+    return conntable_hash_2words(&table->hash, (__force u32) daddr,
+        (__force u32) port);
 }
 
 /*
@@ -50,13 +97,13 @@ static inline u32 hashfn(__be32 daddr, __be32 port)
  *
  * TBD   : perform ip conversion outside of core table operations
  */
-static inline int ipv4_hash32(const unsigned char *ip, unsigned int port,
-    u32 *key)
+static inline int ipv4_hash32(struct cacheobj_conntable *table,
+    const unsigned char *ip, unsigned int port, u32 *key)
 {
     __be32 daddr = 0;
 
     if (ip && (in4_pton(ip, strlen(ip), (u8 *)&daddr, '\0', NULL) == 1)) {
-        *key = hashfn(daddr, (__be32) port);
+        *key = hashfn(table, daddr, (__be32) port);
         return 0;
     } else {
         pr_err("ipv4_hash32 error: null or invalid ip-tuple\n");
@@ -78,23 +125,67 @@ static inline void cacheobj_connection_node_reset_stats
     cacheobjects_stat64_reset(&connp->rx_bytes);
 }
 
+#ifdef CONFIG_CACHEOBJS_STATS
+/* stats of an operation class in a pool, NULL if it saw none yet */
+static inline struct cacheobj_op_stats *__pool_op_stats_peek
+    (struct cacheobj_connection_pool *pool, conn_op_t op)
+{
+    if (op < MAX_OP_TYPE)
+        return &pool->op_stats[op];
+    return READ_ONCE(pool->op_class_stats[op - MAX_OP_TYPE]);
+}
+
+/*
+ * stats of an operation class in a pool, allocated on first use of a
+ * registered class, so a pool only carries the classes put to it.
+ * returns NULL if none could be had, the op then goes uncounted.
+ */
+static struct cacheobj_op_stats *__pool_op_stats
+    (struct cacheobj_connection_pool *pool, conn_op_t op)
+{
+    struct cacheobj_op_stats *ops = __pool_op_stats_peek(pool, op), *old;
+
+    if (ops)
+        return ops;
+    // put may run in atomic context
+    ops = kzalloc(sizeof(*ops), GFP_ATOMIC | __GFP_NOWARN);
+    if (!ops)
+        return NULL;
+    old = cmpxchg(&pool->op_class_stats[op - MAX_OP_TYPE], NULL, ops);
+    if (old) {
+        kfree(ops);
+        ops = old;
+    }
+    return ops;
+}
+#endif
+
 /*
- * connection node stat for updating cumulative time
+ * connection node stat for updating cumulative time, and hold time of
+ * its operation class in the pool
  */
 static inline void cacheobj_connection_node_update_ktime
     (struct cacheobj_connection_node *connp, conn_op_t op)
 {
+    s64 held = ktime_ns_delta(ktime_get(), connp->now_ns);
+#ifdef CONFIG_CACHEOBJS_STATS
+    struct cacheobj_op_stats *ops = __pool_op_stats(connp->pool, op);
+
+    if (ops) {
+        cacheobjects_stat64(&ops->nr_ops);
+        cacheobjects_stat64_add(held, &ops->cum_hold_ns);
+        cacheobjects_hist_add(&ops->hold_hist, held);
+    }
+#endif
     switch (op) {
         case GET:
-            cacheobjects_stat64_add(ktime_ns_delta(ktime_get(), connp->now_ns),
-                    &connp->cum_get_ns);
+            cacheobjects_stat64_add(held, &connp->cum_get_ns);
             break;
         case PUT:
-            cacheobjects_stat64_add(ktime_ns_delta(ktime_get(), connp->now_ns),
-                    &connp->cum_put_ns);
+            cacheobjects_stat64_add(held, &connp->cum_put_ns);
             break;
         default:
-            CONNTBL_ASSERT(0);
+            break;
     }
 }
 
@@ -107,14 +198,16 @@ inline int cacheobj_connection_node_init(struct cacheobj_connection_node *connp,
     CONNTBL_ASSERT(connp);
     CONNTBL_ASSERT(ip);
     CONNTBL_ASSERT(port);
-    connp->ip = kstrdup(ip, GFP_KERNEL);
-    if (!connp->ip) {
-        pr_err("failed to allocate conn ip\n");
-        return -ENOMEM;
+    if (strscpy(connp->ip, ip, sizeof(connp->ip)) < 0) {
+        pr_err("invalid conn ip %s\n", ip);
+        return -EINVAL;
     }
     connp->port = port;
+    connp->flags = 0;
     connp->pool = NULL;
     connp->nr_retry_attempts = 0;
+    connp->lease = 0;
+    atomic_set(&connp->holder_pid, 0);
     atomic_long_set(&connp->state, CONN_DOWN);
     cacheobj_connection_node_reset_stats(connp);
     return 0;
@@ -135,8 +228,7 @@ int cacheobj_connection_node_destroy(struct cacheobj_connection_node *connp)
     CONNTBL_ASSERT(connp->pool == NULL);
     state = atomic_long_read(&connp->state);
     CONNTBL_ASSERT((state != CONN_ACTIVE) || (state != CONN_RETRY));
-    kfree(connp->ip);
-    connp->ip = NULL;
+    connp->ip[0] = '\0';
     connp->port = 0;
     return 0;
 }
@@ -192,57 +284,593 @@ void cacheobj_connection_node_ready(struct cacheobj_connection_node *connp)
     }
 }
 
+#ifdef CONFIG_CACHEOBJS_STATS
+#define PRESSURE_PERIOD (2 * NSEC_PER_SEC)
+#define PRESSURE_FIXED_1 (1UL << 11)
+
+/* 1/exp(period/window) in fixed point, as psi */
+static const unsigned long pressure_exp[NR_PRESSURE_WINDOWS] = {
+    [PRESSURE_AVG10] = 1677,
+    [PRESSURE_AVG60] = 1981,
+    [PRESSURE_AVG300] = 2034,
+};
+
+static void __pressure_init(struct cacheobj_pressure *p)
+{
+    memset(p, 0, sizeof(*p));
+    spin_lock_init(&p->lock);
+    p->state_ns = p->avg_ns = ktime_get_ns();
+}
+
+/*
+ * add time spent in current state up to now
+ * note: caller must have pressure lock
+ */
+static void __pressure_accumulate(struct cacheobj_pressure *p, u64 now)
+{
+    int s;
+
+    for (s = 0; s < NR_PRESSURE_STATES; s++) {
+        if (p->state[s])
+            p->total[s] += now - p->state_ns;
+    }
+    p->state_ns = now;
+}
+
+/*
+ * fold stall time since last averaging into running averages, once a
+ * period has passed. periods nobody looked at decay the averages first.
+ * note: caller must have pressure lock
+ */
+static void __pressure_average(struct cacheobj_pressure *p, u64 now)
+{
+    int s, w;
+    u64 elapsed = now - p->avg_ns, periods, sample, i;
+    unsigned long pct, avg, exp;
+
+    if (elapsed < PRESSURE_PERIOD)
+        return;
+    periods = div64_u64(elapsed, PRESSURE_PERIOD);
+    for (s = 0; s < NR_PRESSURE_STATES; s++) {
+        sample = min(p->total[s] - p->avg_total[s], elapsed);
+        pct = div64_u64(sample * PRESSURE_FIXED_1, div_u64(elapsed, 100));
+        for (w = 0; w < NR_PRESSURE_WINDOWS; w++) {
+            avg = p->avg[s][w];
+            exp = pressure_exp[w];
+            for (i = 1; (i < periods) && avg; i++)
+                avg = avg * exp / PRESSURE_FIXED_1;
+            p->avg[s][w] = (avg * exp + pct * (PRESSURE_FIXED_1 - exp)) /
+                PRESSURE_FIXED_1;
+        }
+        p->avg_total[s] = p->total[s];
+    }
+    p->avg_ns = now;
+}
+
+/*
+ * account a change of waiting or holding callers. returns through cw and ch
+ * whether either count crossed zero, +1 up or -1 down, which is when the
+ * stall state may change and the only time the lock is taken.
+ */
+static void __pressure_change(struct cacheobj_pressure *p, int dwait,
+    int dhold, int *cw, int *ch)
+{
+    int nr;
+    unsigned long flags;
+    u64 now;
+
+    *cw = *ch = 0;
+    if (dwait) {
+        nr = atomic_add_return(dwait, &p->nr_waiting);
+        if (nr == ((dwait > 0) ? 1 : 0))
+            *cw = dwait;
+    }
+    if (dhold) {
+        nr = atomic_add_return(dhold, &p->nr_holding);
+        if (nr == ((dhold > 0) ? 1 : 0))
+            *ch = dhold;
+    }
+    if (!*cw && !*ch)
+        return;
+
+    now = ktime_get_ns();
+    spin_lock_irqsave(&p->lock, flags);
+    __pressure_accumulate(p, now);
+    __pressure_average(p, now);
+    p->state[PRESSURE_SOME] = atomic_read(&p->nr_waiting) > 0;
+    p->state[PRESSURE_FULL] = p->state[PRESSURE_SOME] &&
+        (atomic_read(&p->nr_holding) <= 0);
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+/*
+ * update pool pressure, and table pressure when the pool starts or stops
+ * having waiters or holders
+ */
+static inline void __pool_pressure(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool, int dwait, int dhold)
+{
+    int cw, ch;
+
+    __pressure_change(&pool->pressure, dwait, dhold, &cw, &ch);
+    if (cw || ch)
+        __pressure_change(&table->pressure, cw, ch, &cw, &ch);
+}
+
+static void __pressure_snapshot(struct cacheobj_pressure *p,
+    struct cacheobj_pressure_stat *stat)
+{
+    int s, w;
+    unsigned long flags;
+    u64 now = ktime_get_ns();
+
+    spin_lock_irqsave(&p->lock, flags);
+    __pressure_accumulate(p, now);
+    __pressure_average(p, now);
+    for (s = 0; s < NR_PRESSURE_STATES; s++) {
+        for (w = 0; w < NR_PRESSURE_WINDOWS; w++)
+            stat->avg[s][w] = p->avg[s][w] * 100 / PRESSURE_FIXED_1;
+        stat->total_us[s] = div_u64(p->total[s], NSEC_PER_USEC);
+    }
+    spin_unlock_irqrestore(&p->lock, flags);
+}
+
+static void __pressure_show(struct seq_file *m, const char *name,
+    struct cacheobj_pressure *p)
+{
+    int s;
+    struct cacheobj_pressure_stat stat;
+    static const char * const names[NR_PRESSURE_STATES] = { "some", "full" };
+
+    __pressure_snapshot(p, &stat);
+    for (s = 0; s < NR_PRESSURE_STATES; s++) {
+        seq_printf(m, "%s %s avg10=%lu.%02lu avg60=%lu.%02lu "
+                "avg300=%lu.%02lu total=%llu\n", name, names[s],
+                stat.avg[s][PRESSURE_AVG10] / 100,
+                stat.avg[s][PRESSURE_AVG10] % 100,
+                stat.avg[s][PRESSURE_AVG60] / 100,
+                stat.avg[s][PRESSURE_AVG60] % 100,
+                stat.avg[s][PRESSURE_AVG300] / 100,
+                stat.avg[s][PRESSURE_AVG300] % 100, stat.total_us[s]);
+    }
+}
+#else
+#define __pressure_init(p) do { } while (0)
+#define __pool_pressure(table, pool, dwait, dhold) do { } while (0)
+#endif
+
+/*
+ * table lock wrappers, accounting wait and hold times in per cpu lock stats.
+ * lock returns the acquire time, to be passed back on unlock.
+ */
+#ifdef CONFIG_CACHEOBJS_STATS
+static inline void __lock_stat_waited(struct cacheobj_conntable *table,
+    int lock, u64 wait_ns)
+{
+    this_cpu_inc(table->lock_stats->lock[lock].nr_contended);
+    this_cpu_add(table->lock_stats->lock[lock].cum_wait_ns, wait_ns);
+}
+
+static inline void __lock_stat_acquired(struct cacheobj_conntable *table,
+    int lock)
+{
+    this_cpu_inc(table->lock_stats->lock[lock].nr_acquired);
+}
+
+static inline void __lock_stat_held(struct cacheobj_conntable *table,
+    int lock, u64 locked_ns)
+{
+    __lock_stat_acquired(table, lock);
+    this_cpu_add(table->lock_stats->lock[lock].cum_hold_ns,
+        local_clock() - locked_ns);
+}
+#else
+#define __lock_stat_waited(table, lock, wait_ns) do { } while (0)
+#define __lock_stat_acquired(table, lock) do { } while (0)
+#define __lock_stat_held(table, lock, locked_ns) do { } while (0)
+#endif
+
+static inline u64 __table_read_lock(struct cacheobj_conntable *table)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    u64 start;
+
+    if (!read_trylock(&table->lock)) {
+        start = local_clock();
+        read_lock(&table->lock);
+        __lock_stat_waited(table, LOCK_TABLE_READ, local_clock() - start);
+    }
+    return local_clock();
+#else
+    read_lock(&table->lock);
+    return 0;
+#endif
+}
+
+static inline void __table_read_unlock(struct cacheobj_conntable *table,
+    u64 locked_ns)
+{
+    __lock_stat_held(table, LOCK_TABLE_READ, locked_ns);
+    read_unlock(&table->lock);
+}
+
+/* writers disable bottom halves, as readers may run in softirq */
+static inline u64 __table_write_lock(struct cacheobj_conntable *table)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    u64 start;
+
+    local_bh_disable();
+    if (!write_trylock(&table->lock)) {
+        start = local_clock();
+        write_lock(&table->lock);
+        __lock_stat_waited(table, LOCK_TABLE_WRITE, local_clock() - start);
+    }
+    return local_clock();
+#else
+    write_lock_bh(&table->lock);
+    return 0;
+#endif
+}
+
+static inline void __table_write_unlock(struct cacheobj_conntable *table,
+    u64 locked_ns)
+{
+    __lock_stat_held(table, LOCK_TABLE_WRITE, locked_ns);
+#ifdef CONFIG_CACHEOBJS_STATS
+    write_unlock(&table->lock);
+    local_bh_enable();
+#else
+    write_unlock_bh(&table->lock);
+#endif
+}
+
+/*
+ * allocate zeroed memory for a node or pool. a failed opportunistic
+ * allocation falls back to the table reserve, and if that is empty too,
+ * waits for a node or pool to be freed back to it.
+ */
+static void *__conntable_reserve_alloc(struct cacheobj_conntable *table,
+    mempool_t *reserve, size_t size)
+{
+    void *p;
+
+    p = kzalloc(size, GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN);
+    if (p)
+        return p;
+
+    p = mempool_alloc(reserve, GFP_NOWAIT | __GFP_NOWARN);
+    if (!p) {
+        cacheobjects_stat64(&table->nr_reserve_exhausted);
+        p = mempool_alloc(reserve, GFP_KERNEL); // never fails, may sleep
+    }
+    cacheobjects_stat64(&table->nr_reserve_used);
+    memset(p, 0, size);
+    return p;
+}
+
+/*
+ * free a node or pool, refilling the reserve first
+ */
+static inline void __conntable_reserve_free(mempool_t *reserve, void *p)
+{
+    if (reserve)
+        mempool_free(p, reserve);
+    else
+        kfree(p);
+}
+
+static void __conntable_reserve_destroy(struct cacheobj_conntable *table)
+{
+    mempool_destroy(table->node_reserve);
+    mempool_destroy(table->pool_reserve);
+    table->node_reserve = NULL;
+    table->pool_reserve = NULL;
+}
+
+static int __conntable_reserve_create(struct cacheobj_conntable *table)
+{
+    if (!table->reserve_nr)
+        table->reserve_nr = CONNTABLE_RESERVE_DEFAULT;
+
+    table->node_reserve = mempool_create_kmalloc_pool(table->reserve_nr,
+        sizeof(struct cacheobj_connection_node));
+    table->pool_reserve = mempool_create_kmalloc_pool(table->reserve_nr,
+        sizeof(struct cacheobj_connection_pool));
+    if (!table->node_reserve || !table->pool_reserve) {
+        __conntable_reserve_destroy(table);
+        return -ENOMEM;
+    }
+    cacheobjects_stat64_reset(&table->nr_reserve_used);
+    cacheobjects_stat64_reset(&table->nr_reserve_exhausted);
+    return 0;
+}
+
 /*
  * initialize conn hash table and associated lock for protection
  * Note: We use a static hashtable(no resizing) for managing connection pools.
  */
+static void connectionpool_watchdog_fn(struct work_struct *work);
+
 static int connectionpool_hashtable_init(struct cacheobj_conntable *table)
 {
+    int err;
+    static const char * const op_names[MAX_OP_TYPE] = {
+        [GET] = "get",
+        [PUT] = "put",
+    };
+
+    err = conntable_hash_seed(&table->hash);
+    if (err) {
+        pr_err("conntable hash %d unknown\n", table->hash.fn);
+        return err;
+    }
+    err = __conntable_reserve_create(table);
+    if (err) {
+        pr_err("conntable reserve alloc failed\n");
+        return err;
+    }
+#ifdef CONFIG_CACHEOBJS_STATS
+    table->lock_stats = alloc_percpu(struct cacheobj_lock_stats);
+    if (!table->lock_stats) {
+        pr_err("conntable lock stats alloc failed\n");
+        __conntable_reserve_destroy(table);
+        return -ENOMEM;
+    }
+    err = conntrace_init(&table->trace, table->trace_threshold_ns,
+        table->outlier_threshold_ns);
+    if (err) {
+        pr_err("conntable flight recorder alloc failed\n");
+        free_percpu(table->lock_stats);
+        table->lock_stats = NULL;
+        __conntable_reserve_destroy(table);
+        return err;
+    }
+    err = conntable_probe_stats_init(table);
+    if (err) {
+        pr_err("conntable probe stats alloc failed\n");
+        conntrace_exit(&table->trace);
+        free_percpu(table->lock_stats);
+        table->lock_stats = NULL;
+        __conntable_reserve_destroy(table);
+        return err;
+    }
+    err = conntable_topk_init(&table->topk);
+    if (err) {
+        pr_err("conntable topk alloc failed\n");
+        conntable_probe_stats_exit(table);
+        conntrace_exit(&table->trace);
+        free_percpu(table->lock_stats);
+        table->lock_stats = NULL;
+        __conntable_reserve_destroy(table);
+        return err;
+    }
+#endif
     hash_init(table->buckets);
     rwlock_init(&table->lock);
+    table->watchdog_interval = 0;
+    INIT_LIST_HEAD(&table->groups);
+    table->nr_pools = 0;
+    if (!table->ring_vnodes)
+        table->ring_vnodes = RING_VNODES_DEFAULT;
+    mutex_init(&table->ring_lock);
+    RCU_INIT_POINTER(table->ring, NULL);
+    table->ring_dirty = false;
+    INIT_DELAYED_WORK(&table->watchdog, connectionpool_watchdog_fn);
+    __pressure_init(&table->pressure);
+    for (table->nr_op_classes = 0; table->nr_op_classes < MAX_OP_TYPE;
+        table->nr_op_classes++)
+        strscpy(table->op_classes[table->nr_op_classes],
+            op_names[table->nr_op_classes], OP_CLASS_NAME_LEN);
     return 0;
 }
 
 /*
- * allocate and initialize a connection pool
+ * register an operation class to put connections with.
+ * returns class id (same id if name is already registered), or -ENOSPC
+ */
+static int connectionpool_op_register(struct cacheobj_conntable *table,
+    const char *name)
+{
+    u64 locked;
+    int id;
+
+    locked = __table_write_lock(table);
+    for (id = 0; id < table->nr_op_classes; id++) {
+        if (!strncmp(table->op_classes[id], name, OP_CLASS_NAME_LEN - 1))
+            goto exit;
+    }
+    if (id == MAX_OP_CLASSES) {
+        id = -ENOSPC;
+        goto exit;
+    }
+    strscpy(table->op_classes[id], name, OP_CLASS_NAME_LEN);
+    // name visible before id is, see dump
+    smp_store_release(&table->nr_op_classes, id + 1);
+exit:
+    __table_write_unlock(table, locked);
+    return id;
+}
+
+/*
+ * set token bucket rate and fill it to its burst
+ */
+static void __token_bucket_init(struct cacheobj_token_bucket *tb, u64 rate)
+{
+    // keep elapsed(ns) * rate within 64 bits in refill
+    rate = min_t(u64, rate, U64_MAX / NSEC_PER_SEC);
+    atomic64_set(&tb->tokens, rate);
+    atomic64_set(&tb->last_ns, ktime_get_ns());
+    WRITE_ONCE(tb->rate, rate);
+}
+
+/*
+ * credit tokens for time elapsed since last refill. the refill window is
+ * claimed with cmpxchg so concurrent callers never credit the same time
+ * twice, and time is only consumed once it is worth at least a token.
+ * only the time worth the whole tokens credited is consumed, the fraction
+ * left carries over so low rates are not rounded down on every refill.
+ */
+static inline void __token_bucket_refill(struct cacheobj_token_bucket *tb,
+    u64 rate)
+{
+    u64 now = ktime_get_ns(), elapsed, add, next;
+    s64 last = atomic64_read(&tb->last_ns), tokens;
+
+    if (now <= last)
+        return;
+    elapsed = min_t(u64, now - last, NSEC_PER_SEC);
+    add = div64_u64(elapsed * rate, NSEC_PER_SEC);
+    if (!add)
+        return;
+    // idle past a full burst, the rest would be capped away anyway
+    next = (now - last > NSEC_PER_SEC) ? now :
+        min_t(u64, now, last + div64_u64(add * NSEC_PER_SEC, rate));
+    if (atomic64_cmpxchg(&tb->last_ns, last, next) != last)
+        return;
+
+    tokens = atomic64_add_return(add, &tb->tokens);
+    while (tokens > (s64)rate) {
+        s64 old = atomic64_cmpxchg(&tb->tokens, tokens, rate);
+        if (old == tokens)
+            break;
+        tokens = old;
+    }
+}
+
+/*
+ * take n tokens, fails (taking none) if not enough are left
+ */
+static inline bool __token_bucket_take(struct cacheobj_token_bucket *tb, u64 n)
+{
+    u64 rate = READ_ONCE(tb->rate);
+
+    if (!rate)
+        return true;
+    __token_bucket_refill(tb, rate);
+    if (atomic64_sub_return(n, &tb->tokens) < 0) {
+        atomic64_add(n, &tb->tokens);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * charge n tokens, possibly into debt. returns false if in debt.
+ */
+static inline bool __token_bucket_charge(struct cacheobj_token_bucket *tb,
+    u64 n)
+{
+    u64 rate = READ_ONCE(tb->rate);
+
+    if (!rate)
+        return true;
+    __token_bucket_refill(tb, rate);
+    return atomic64_sub_return(n, &tb->tokens) >= 0;
+}
+
+/*
+ * admit a get against pool rate limits, an op token is needed and byte
+ * debt from earlier traffic must have been paid back
+ */
+static inline bool __connection_pool_admit(struct cacheobj_connection_pool
+    *pool)
+{
+    if (!__token_bucket_charge(&pool->bytes_limit, 0))
+        return false;
+    return __token_bucket_take(&pool->ops_limit, 1);
+}
+
+/*
+ * allocate and initialize a connection pool. with reserve, the allocation
+ * may be served by the table reserve and waits on it rather than failing,
+ * for inserts bringing a node back. bulk loads build many pools at once and
+ * must not drain the reserve, they take a plain allocation which may fail.
  */
 static struct cacheobj_connection_pool *__connection_pool_alloc
-    (struct cacheobj_conntable *table, const char *ip, unsigned int port)
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+     bool reserve)
 {
-    int err = 0;
+    int err = 0, i;
     struct cacheobj_connection_pool *pool;
 
-    pool = (struct cacheobj_connection_pool *)
-        kzalloc(sizeof(struct cacheobj_connection_pool), GFP_KERNEL);
-    if (!pool) {
-        pr_err("connection pool alloc failed "POOL_FMT"\n", ip, port);
-        err = -ENOMEM;
-        goto nomem_pool;
+    if (strlen(ip) >= INET_ADDRSTRLEN) {
+        pr_err("connection pool ip invalid "POOL_FMT"\n", ip, port);
+        err = -EINVAL;
+        goto bad_ip;
     }
 
-    pool->ip = kstrdup(ip, GFP_KERNEL);
-    if (!pool->ip) {
-        pr_err("connection pool ip alloc failed "POOL_FMT"\n", ip, port);
-        err = -ENOMEM;
-        goto nomem_ip;
-    }
+    if (reserve)
+        pool = (struct cacheobj_connection_pool *)__conntable_reserve_alloc
+            (table, table->pool_reserve,
+             sizeof(struct cacheobj_connection_pool));
+    else
+        pool = kzalloc(sizeof(struct cacheobj_connection_pool), GFP_KERNEL);
+    if (!pool)
+        return ERR_PTR(-ENOMEM);
+    strscpy(pool->ip, ip, sizeof(pool->ip));
     pool->port = port;
 
+    // optional, pool runs without affinity hints rather than failing
+    pool->last_conn = alloc_percpu_gfp(struct cacheobj_connection_node *,
+        GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN);
+    if (!pool->last_conn)
+        pr_warn("connection pool without affinity "POOL_FMT"\n", ip, port);
+
     // connection list
     INIT_LIST_HEAD(&pool->conn_list);
     sema_init(&pool->conn_sem, 0);
+    spin_lock_init(&pool->wait_lock);
+    INIT_LIST_HEAD(&pool->wait_list);
+    atomic_set(&pool->nr_waiters, 0);
+    __pressure_init(&pool->pressure);
+    __token_bucket_init(&pool->ops_limit, 0);
+    __token_bucket_init(&pool->bytes_limit, 0);
 
     // pool is a hashtable node
     INIT_HLIST_NODE(&pool->hentry);
 
     cacheobjects_stat64_reset(&pool->nr_slow_paths);
+    cacheobjects_stat64_reset(&pool->nr_affinity_hits);
+    cacheobjects_stat64_reset(&pool->nr_affinity_misses);
+    cacheobjects_stat64_reset(&pool->nr_handoffs);
+    cacheobjects_stat64_reset(&pool->nr_wakeups);
+    cacheobjects_stat64_reset(&pool->cum_wake_ns);
+    cacheobjects_stat64_reset(&pool->nr_lease_expired);
+    cacheobjects_stat64_reset(&pool->nr_lease_recycled);
+    cacheobjects_stat64_reset(&pool->nr_stale_puts);
+    cacheobjects_stat64_reset(&pool->nr_hedges);
+    cacheobjects_stat64_reset(&pool->nr_hedge_wins);
+    cacheobjects_stat64_reset(&pool->nr_throttled_gets);
+    cacheobjects_stat64_reset(&pool->nr_throttled_bytes);
+    cacheobjects_stat64_reset(&pool->nr_try_misses);
+    for (i = 0; i < MAX_OP_TYPE; i++) {
+        cacheobjects_stat64_reset(&pool->op_stats[i].nr_ops);
+        cacheobjects_stat64_reset(&pool->op_stats[i].cum_hold_ns);
+        cacheobjects_hist_reset(&pool->op_stats[i].hold_hist);
+    }
+    memset(pool->op_class_stats, 0, sizeof(pool->op_class_stats));
+    cacheobjects_hist_reset(&pool->wait_hist);
     return pool;
 
-nomem_ip:
-    kfree(pool);
+bad_ip:
+    return ERR_PTR(err);
+}
+
+/*
+ * release memory of a connection pool which is not (or no longer) hashed
+ */
+static void __connection_pool_free(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    int i;
 
-nomem_pool:
-    return ERR_PTR(-err);
+    for (i = 0; i < MAX_OP_CLASSES - MAX_OP_TYPE; i++)
+        kfree(pool->op_class_stats[i]);
+#endif
+    free_percpu(pool->last_conn);
+    __conntable_reserve_free(table->pool_reserve, pool);
 }
 
 /*
@@ -253,7 +881,8 @@ nomem_pool:
  * For simplicity, regular conntable ops work under assumption that pool does
  * not slip underneath us. This MUST be called only as part of teardown.
  */
-static int __connection_pool_destroy(struct cacheobj_connection_pool *pool)
+static int __connection_pool_destroy(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool)
 {
     CONNTBL_ASSERT(pool);
 
@@ -268,11 +897,166 @@ static int __connection_pool_destroy(struct cacheobj_connection_pool *pool)
     }
 
     hash_del(&pool->hentry);
-    kfree(pool->ip);
-    kfree(pool);
+    __connection_pool_free(table, pool);
+    return 0;
+}
+
+/*
+ * consistent hash ring, rebuilt as a whole on pool insert and destroy and
+ * published via rcu, so key lookups never take the table lock.
+ * vnode hashes use a fixed seed, routing is stable across hosts and reloads.
+ */
+struct ring_point {
+    u32 point;
+    u32 owner;
+};
+
+static int ring_point_cmp(const void *a, const void *b)
+{
+    u32 pa = ((const struct ring_point *)a)->point;
+    u32 pb = ((const struct ring_point *)b)->point;
+
+    return (pa > pb) - (pa < pb);
+}
+
+static void __conntable_ring_free(struct rcu_head *rcu)
+{
+    kvfree(container_of(rcu, struct cacheobj_hash_ring, rcu));
+}
+
+static struct cacheobj_hash_ring *__conntable_ring_alloc(unsigned int nr_nodes,
+    unsigned int vnodes)
+{
+    size_t nr_points = (size_t)nr_nodes * vnodes;
+    struct cacheobj_hash_ring *ring;
+
+    ring = kvzalloc(sizeof(struct cacheobj_hash_ring) +
+            nr_points * 2 * sizeof(u32) + nr_nodes * sizeof(*ring->nodes),
+            GFP_KERNEL);
+    if (!ring)
+        return NULL;
+
+    ring->nr_nodes = nr_nodes;
+    ring->nr_points = nr_points;
+    ring->points = (u32 *)(ring + 1);
+    ring->owner = ring->points + nr_points;
+    ring->nodes = (void *)(ring->owner + nr_points);
+    return ring;
+}
+
+/*
+ * rebuild ring from current table pools and publish it. pools added once
+ * the dirty mark is cleared mark it again, for the next use to rebuild.
+ */
+static int __conntable_ring_rebuild(struct cacheobj_conntable *table)
+{
+    u64 locked;
+    int bkt;
+    u32 h, i, v, pos, nr_nodes;
+    struct ring_point *rp = NULL;
+    struct cacheobj_hash_ring *ring = NULL, *old;
+    struct cacheobj_connection_pool *pool;
+
+    mutex_lock(&table->ring_lock);
+    WRITE_ONCE(table->ring_dirty, false);
+retry:
+    locked = __table_read_lock(table);
+    nr_nodes = table->nr_pools;
+    __table_read_unlock(table, locked);
+
+    if (nr_nodes) {
+        ring = __conntable_ring_alloc(nr_nodes, table->ring_vnodes);
+        rp = kvmalloc_array(ring ? ring->nr_points : 0,
+                sizeof(struct ring_point), GFP_KERNEL);
+        if (!ring || !rp) {
+            kvfree(ring);
+            kvfree(rp);
+            // leave it to the next use
+            WRITE_ONCE(table->ring_dirty, true);
+            mutex_unlock(&table->ring_lock);
+            pr_err("hash ring alloc failed for %u pools\n", nr_nodes);
+            return -ENOMEM;
+        }
+
+        i = 0;
+        locked = __table_read_lock(table);
+        if (nr_nodes != table->nr_pools) {
+            __table_read_unlock(table, locked);
+            kvfree(ring);
+            kvfree(rp);
+            goto retry;
+        }
+        hash_for_each(table->buckets, bkt, pool, hentry) {
+            strscpy(ring->nodes[i].ip, pool->ip, INET_ADDRSTRLEN);
+            ring->nodes[i].port = pool->port;
+            h = jhash(pool->ip, strlen(pool->ip), 0);
+            for (v = 0; v < table->ring_vnodes; v++) {
+                pos = i * table->ring_vnodes + v;
+                rp[pos].point = jhash_2words(h, pool->port, v);
+                rp[pos].owner = i;
+            }
+            i++;
+        }
+        __table_read_unlock(table, locked);
+
+        sort(rp, ring->nr_points, sizeof(struct ring_point), ring_point_cmp,
+                NULL);
+        for (pos = 0; pos < ring->nr_points; pos++) {
+            ring->points[pos] = rp[pos].point;
+            ring->owner[pos] = rp[pos].owner;
+        }
+        kvfree(rp);
+
+        // first point at or above each top-bits range
+        for (i = 0, pos = 0; i <= (1 << RING_INDEX_BITS); i++) {
+            u64 lo = (u64)i << (32 - RING_INDEX_BITS);
+            while ((pos < ring->nr_points) && (ring->points[pos] < lo))
+                pos++;
+            ring->index[i] = pos;
+        }
+    }
+
+    old = rcu_dereference_protected(table->ring,
+            lockdep_is_held(&table->ring_lock));
+    rcu_assign_pointer(table->ring, ring);
+    mutex_unlock(&table->ring_lock);
+
+    if (old)
+        call_rcu(&old->rcu, __conntable_ring_free);
     return 0;
 }
 
+/*
+ * rebuild ring if pools were added since it was built. inserts only mark
+ * it, so filling a table of N pools does not rebuild it N times.
+ * note: may sleep
+ */
+static inline void __conntable_ring_sync(struct cacheobj_conntable *table)
+{
+    if (READ_ONCE(table->ring_dirty) && __conntable_ring_rebuild(table))
+        pr_err("hash ring not updated\n");
+}
+
+/*
+ * locate the node owning hash, first point clockwise at or above it
+ * note: caller must be in rcu read side section
+ */
+static inline unsigned int __conntable_ring_locate(struct cacheobj_hash_ring
+    *ring, u32 hash)
+{
+    u32 b = hash >> (32 - RING_INDEX_BITS);
+    u32 lo = ring->index[b], hi = ring->index[b + 1], mid;
+
+    while (lo < hi) {
+        mid = lo + ((hi - lo) >> 1);
+        if (ring->points[mid] < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return ring->owner[(lo == ring->nr_points) ? 0 : lo];
+}
+
 /*
  * get connection pool given ip and port.
  * Note:
@@ -283,69 +1067,469 @@ static inline struct cacheobj_connection_pool *__get_connection_pool
     (struct cacheobj_conntable *table, const char *ip, unsigned int port,
     u32 key)
 {
+    unsigned int probes = 0;
     struct cacheobj_connection_pool *pool;
 
     hash_for_each_possible(table->buckets, pool, hentry, key) {
-        if ((pool->port == port) && (strcmp(pool->ip, ip) == 0))
+        probes++;
+        if ((pool->port == port) && (strcmp(pool->ip, ip) == 0)) {
+            conntable_probe_record(table, probes);
             return pool;
+        }
     }
+    conntable_probe_record(table, probes);
     pr_debug("connection pool not found "POOL_FMT"\n", ip, port);
     return NULL;
 }
 
 /*
- * insert new connection entry to table, protected
- * returns 0 on success otherwise err
+ * try the connection last handed out on this cpu, if it is ready.
+ * note:
+ * -caller must have table read lock and hold a pool semaphore count
+ * -hints are cleared on connection remove under table write lock, so a
+ *  non-null hint always points to a connection of this pool
  */
-static int connectionpool_hashtable_insert(struct cacheobj_conntable *table,
-        struct cacheobj_connection_node *connp)
+static inline struct cacheobj_connection_node *__connection_affinity_get
+    (struct cacheobj_connection_pool *pool)
 {
-    u32 key = 0;
-    struct cacheobj_connection_pool *pool, *new_pool = NULL;
+    struct cacheobj_connection_node *connp;
 
-    CONNTBL_ASSERT(connp);
+    if (!pool->last_conn)
+        return NULL;
+    connp = *raw_cpu_ptr(pool->last_conn);
+    if (connp && (atomic_long_cmpxchg(&connp->state, CONN_READY, CONN_ACTIVE)
+            == CONN_READY)) {
+        cacheobjects_stat64(&pool->nr_affinity_hits);
+        return connp;
+    }
+    cacheobjects_stat64(&pool->nr_affinity_misses);
+    return NULL;
+}
 
-    if (ipv4_hash32(connp->ip, connp->port, &key) < 0)
+/*
+ * remember connection handed out on this cpu
+ * note: caller must have table read lock
+ */
+static inline void __connection_affinity_set(struct cacheobj_connection_pool
+    *pool, struct cacheobj_connection_node *connp)
+{
+    if (pool->last_conn)
+        *raw_cpu_ptr(pool->last_conn) = connp;
+}
+
+/*
+ * drop all per-cpu hints to a connection leaving the pool
+ * note: caller must have table write lock
+ */
+static void __connection_affinity_clear(struct cacheobj_connection_pool
+    *pool, struct cacheobj_connection_node *connp)
+{
+    int cpu;
+    struct cacheobj_connection_node **last;
+
+    if (!pool->last_conn)
+        return;
+    for_each_possible_cpu(cpu) {
+        last = per_cpu_ptr(pool->last_conn, cpu);
+        if (*last == connp)
+            *last = NULL;
+    }
+}
+
+/*
+ * release an active connection to its pool.
+ * -connection is handed to the oldest parked getter and stays active, or
+ *  marked ready and accounted in pool semaphore when no one is waiting
+ * note: waiters always retake wait_lock before leaving, so waking one
+ * under the lock is safe even though it lives on the getter stack.
+ * wait_lock is irq safe, release runs from put in any context.
+ * returns true if connection was handed off
+ */
+static bool __connection_pool_release(struct cacheobj_connection_pool *pool,
+    struct cacheobj_connection_node *connp)
+{
+    unsigned long flags;
+    struct cacheobj_connection_waiter *waiter;
+    struct cacheobj_connection_claim *claim;
+
+    spin_lock_irqsave(&pool->wait_lock, flags);
+    while (!list_empty(&pool->wait_list)) {
+        waiter = list_first_entry(&pool->wait_list,
+                struct cacheobj_connection_waiter, list);
+        list_del_init(&waiter->list);
+        claim = waiter->claim;
+        // hedged getter may have been served by its other pool
+        if (cmpxchg(&claim->connp, NULL, connp) != NULL)
+            continue;
+        claim->pool = pool;
+        cacheobjects_stat64_ktime(&claim->handoff_ns);
+        wake_up_process(claim->task);
+        spin_unlock_irqrestore(&pool->wait_lock, flags);
+        cacheobjects_stat64(&pool->nr_handoffs);
+        return true;
+    }
+    atomic_long_set(&connp->state, CONN_READY);
+    cacheobjects_stat64_ktime(&pool->last_release_ns);
+    up(&pool->conn_sem);
+    spin_unlock_irqrestore(&pool->wait_lock, flags);
+    return false;
+}
+
+/*
+ * sleep until claim is served or timeout (jiffies) runs out
+ * returns remaining timeout
+ */
+static long __connection_claim_sleep(struct cacheobj_connection_claim *claim,
+    long timeout)
+{
+    while (timeout) {
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        if (READ_ONCE(claim->connp))
+            break;
+        timeout = schedule_timeout(timeout);
+    }
+    __set_current_state(TASK_RUNNING);
+    return timeout;
+}
+
+/*
+ * park on pool wait list, unless a semaphore count can be taken.
+ * returns true if a count was taken and waiter was not queued
+ * note: caller must have pool wait_lock
+ */
+static inline bool __connection_waiter_add(struct cacheobj_connection_pool
+    *pool, struct cacheobj_connection_waiter *waiter,
+    struct cacheobj_connection_claim *claim)
+{
+    // a put may have slipped in after our failed fast path attempt
+    if (!down_trylock(&pool->conn_sem))
+        return true;
+    waiter->claim = claim;
+    list_add_tail(&waiter->list, &pool->wait_list);
+    return false;
+}
+
+/*
+ * leave pool wait list, after this no put can reach the claim
+ */
+static inline void __connection_waiter_del(struct cacheobj_connection_pool
+    *pool, struct cacheobj_connection_waiter *waiter)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pool->wait_lock, flags);
+    // put dequeues with list_del_init when serving
+    if (!list_empty(&waiter->list))
+        list_del_init(&waiter->list);
+    spin_unlock_irqrestore(&pool->wait_lock, flags);
+}
+
+/*
+ * park on pool wait list until a put hands over a connection.
+ * returns:
+ *  handed-off (active) connection, with *handoff_ns set to hand-off time
+ *  NULL with *err 0, if a pool semaphore count was taken instead
+ *  NULL with *err -ETIME on timeout
+ */
+static struct cacheobj_connection_node *__connection_pool_wait
+    (struct cacheobj_connection_pool *pool, long timeout, ktime_t *handoff_ns,
+    int *err)
+{
+    struct cacheobj_connection_waiter waiter;
+    struct cacheobj_connection_claim claim = { .task = current };
+    unsigned long flags;
+    bool taken;
+
+    spin_lock_irqsave(&pool->wait_lock, flags);
+    taken = __connection_waiter_add(pool, &waiter, &claim);
+    spin_unlock_irqrestore(&pool->wait_lock, flags);
+    if (taken) {
+        *err = 0;
+        return NULL;
+    }
+
+    __connection_claim_sleep(&claim, timeout);
+    __connection_waiter_del(pool, &waiter);
+
+    *handoff_ns = claim.handoff_ns;
+    *err = claim.connp ? 0 : -ETIME;
+    return claim.connp;
+}
+
+/*
+ * hedged pool wait. park on primary pool and, if still unserved after
+ * hedge_after jiffies, on the secondary pool too. first one to hand off
+ * (or to have a free semaphore count at hedge time) wins, the other pool
+ * never sees the claim served so nothing has to be given back.
+ * returns as __connection_pool_wait, with *from set to the pool which
+ * served the getter.
+ */
+static struct cacheobj_connection_node *__connection_pool_hedged_wait
+    (struct cacheobj_connection_pool *pool,
+    struct cacheobj_connection_pool *hedge, long timeout, long hedge_after,
+    ktime_t *handoff_ns, struct cacheobj_connection_pool **from, int *err)
+{
+    struct cacheobj_connection_waiter waiter[2];
+    struct cacheobj_connection_claim claim = { .task = current };
+    long first = min(hedge_after, timeout), left;
+    unsigned long flags;
+    bool taken, queued = false;
+
+    *from = pool;
+    spin_lock_irqsave(&pool->wait_lock, flags);
+    taken = __connection_waiter_add(pool, &waiter[0], &claim);
+    spin_unlock_irqrestore(&pool->wait_lock, flags);
+    if (taken) {
+        *err = 0;
+        return NULL;
+    }
+
+    left = timeout - first + __connection_claim_sleep(&claim, first);
+    if (!READ_ONCE(claim.connp) && (first < timeout)) {
+        cacheobjects_stat64(&pool->nr_hedges);
+        spin_lock_irqsave(&hedge->wait_lock, flags);
+        if (!down_trylock(&hedge->conn_sem)) {
+            if (cmpxchg(&claim.connp, NULL, CLAIM_TAKEN) == NULL) {
+                *from = hedge;
+            } else {
+                // primary won the race, count goes back with no waiters
+                up(&hedge->conn_sem);
+            }
+        } else {
+            waiter[1].claim = &claim;
+            list_add_tail(&waiter[1].list, &hedge->wait_list);
+            queued = true;
+        }
+        spin_unlock_irqrestore(&hedge->wait_lock, flags);
+        if (queued)
+            __connection_claim_sleep(&claim, left);
+    }
+
+    __connection_waiter_del(pool, &waiter[0]);
+    if (queued)
+        __connection_waiter_del(hedge, &waiter[1]);
+
+    if (claim.connp == CLAIM_TAKEN) {
+        *err = 0;
+        return NULL;
+    }
+    if (claim.connp)
+        *from = claim.pool;
+    *handoff_ns = claim.handoff_ns;
+    *err = claim.connp ? 0 : -ETIME;
+    return claim.connp;
+}
+
+/*
+ * jiffies a hedged get waits on its primary pool before trying the secondary
+ */
+static inline long __connection_hedge_after(struct cacheobj_connection_pool
+    *pool, const struct conn_hedge *hedge)
+{
+    if (hedge->after)
+        return hedge->after;
+    return max_t(long, 1, nsecs_to_jiffies(cacheobjects_hist_percentile
+        (&pool->wait_hist, 95)));
+}
+
+/* lease bit of a lease the watchdog reported expired */
+#define LEASE_REPORTED (1UL << (BITS_PER_LONG - 1))
+
+/*
+ * record the holder of a connection just handed out
+ */
+static inline void __connection_lease_start(struct cacheobj_connection_node
+    *connp, unsigned long lease)
+{
+    connp->lease = lease;
+    connp->lease_start = jiffies;
+    if (lease)
+        memcpy(connp->holder_comm, current->comm, TASK_COMM_LEN);
+    smp_wmb(); // lease visible before holder, see watchdog
+    atomic_set(&connp->holder_pid, task_pid_nr(current));
+}
+
+/*
+ * claim connection back from its holder on put.
+ * returns false if the watchdog revoked the lease and recycled the connection.
+ * note: only leases of exited holders are revoked, so such a put comes from
+ * a task the connection was passed to, which must not outlive its getter.
+ */
+static inline bool __connection_lease_end(struct cacheobj_connection_node
+    *connp)
+{
+    int pid = atomic_read(&connp->holder_pid);
+
+    if ((pid < 0) || (atomic_cmpxchg(&connp->holder_pid, pid, 0) != pid))
+        return false;
+    connp->lease = 0;
+    return true;
+}
+
+/*
+ * true once the task of a holder pid has exited. a live holder could still
+ * put the connection after it was handed out again, which put cannot tell
+ * from a put of the new holder, so only connections of exited holders are
+ * recycled. a reused pid keeps its connection, as if alive.
+ */
+static bool __connection_holder_gone(int pid)
+{
+    bool gone;
+
+    rcu_read_lock();
+    gone = !pid_task(find_pid_ns(pid, &init_pid_ns), PIDTYPE_PID);
+    rcu_read_unlock();
+    return gone;
+}
+
+/*
+ * revoke an expired lease and give the connection back to the pool.
+ * returns false if the holder put the connection in the meantime.
+ * note: caller must have table read lock
+ */
+static bool __connection_lease_revoke(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool,
+    struct cacheobj_connection_node *connp, int pid)
+{
+    if (atomic_cmpxchg(&connp->holder_pid, pid, -pid) != pid)
+        return false;
+    connp->lease = 0;
+    __connection_pool_release(pool, connp);
+    __pool_pressure(table, pool, 0, -1);
+    return true;
+}
+
+#ifdef CONFIG_CACHEOBJS_STATS
+/*
+ * capture an operation slower than the outlier threshold, with a snapshot
+ * of its pool. the connection list is only counted if the table lock can
+ * be had without waiting, so this is safe wherever put is.
+ */
+static void __connection_outlier(struct cacheobj_conntable *table,
+    conntrace_op_t op, struct cacheobj_connection_pool *pool,
+    struct cacheobj_connection_node *connp, u64 latency_ns, u64 slow_paths)
+{
+    struct conntrace_pool_state st = { 0 };
+    struct cacheobj_connection_node *c;
+
+    if (!conntrace_outlier_allowed(&table->trace))
+        return;
+
+    st.nr_waiters = atomic_read(&pool->nr_waiters);
+    st.slow_paths = cacheobjects_stat64_read(&pool->nr_slow_paths) -
+        slow_paths;
+    if (read_trylock(&table->lock)) {
+        list_for_each_entry(c, &pool->conn_list, list_node) {
+            switch (atomic_long_read(&c->state)) {
+                case CONN_READY:
+                    st.nr_ready++;
+                    break;
+                case CONN_ACTIVE:
+                    st.nr_active++;
+                    break;
+                case CONN_FAILED:
+                    st.nr_failed++;
+                    break;
+            }
+            if (++st.nr_scanned == OUTLIER_SCAN_MAX)
+                break;
+        }
+        read_unlock(&table->lock);
+    }
+    conntrace_outlier(&table->trace, op, connp->ip, connp->port, latency_ns,
+        &st);
+}
+
+#define CONN_OUTLIER(table, op, pool, connp, latency_ns, slow_paths) \
+    do { \
+        if ((table)->trace.outlier_ns && \
+            ((latency_ns) > (table)->trace.outlier_ns)) \
+            __connection_outlier(table, op, pool, connp, latency_ns, \
+                slow_paths); \
+    } while (0)
+#else
+#define CONN_OUTLIER(table, op, pool, connp, latency_ns, slow_paths) \
+    do { } while (0)
+#endif
+
+/*
+ * sampled get and its wait, against the pool in the heavy hitters
+ */
+static inline void __pool_topk_get(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool, u64 wait_ns)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    if (!conntable_topk_sample(&table->topk))
+        return;
+    __conntable_topk_add(&table->topk, TOPK_GETS, pool->key, pool->ip,
+        pool->port, 1);
+    __conntable_topk_add(&table->topk, TOPK_WAIT_NS, pool->key, pool->ip,
+        pool->port, wait_ns);
+#endif
+}
+
+/*
+ * insert new connection entry to table, protected
+ * returns 0 on success otherwise err
+ */
+static int connectionpool_hashtable_insert(struct cacheobj_conntable *table,
+        struct cacheobj_connection_node *connp)
+{
+    u64 locked;
+    u32 key = 0;
+    bool handed;
+    struct cacheobj_connection_pool *pool, *new_pool = NULL;
+
+    CONNTBL_ASSERT(connp);
+
+    if (ipv4_hash32(table, connp->ip, connp->port, &key) < 0)
         return -EINVAL;
 
-    read_lock(&table->lock);
+    locked = __table_read_lock(table);
     pool = __get_connection_pool(table, connp->ip, connp->port, key);
     if (!pool) {
         bool try_add = false; // for new pool allocation
-        read_unlock(&table->lock);
-        new_pool = __connection_pool_alloc(table, connp->ip, connp->port);
+        __table_read_unlock(table, locked);
+        new_pool = __connection_pool_alloc(table, connp->ip, connp->port,
+            true);
         if (IS_ERR(new_pool)) {
             pr_err("pool allocation failure\n");
             return -ENOMEM;
         }
 
-        write_lock(&table->lock);
+        locked = __table_write_lock(table);
         pool = __get_connection_pool(table, connp->ip, connp->port, key);
         if (!pool) {
+            new_pool->key = key;
             hash_add(table->buckets, &new_pool->hentry, key);
+            table->nr_pools++;
+            WRITE_ONCE(table->ring_dirty, true);
             pool = new_pool;
             try_add = true;
         }
-        write_unlock(&table->lock);
+        __table_write_unlock(table, locked);
         if (!try_add) {
             // someone already created the pool for us
-            kfree(new_pool);
+            __connection_pool_free(table, new_pool);
             new_pool = NULL;
         }
     } else {
-        read_unlock(&table->lock);
+        __table_read_unlock(table, locked);
     }
 
     CONNTBL_ASSERT(pool);
     CONNTBL_ASSERT(!IS_ERR(pool));
     connp->pool = pool;
-    atomic_long_set(&connp->state, CONN_READY);
+    atomic_long_set(&connp->state, CONN_ACTIVE);
 
     /* added to head of per-pool connection chain */
-    write_lock(&table->lock);
+    locked = __table_write_lock(table);
     list_add(&connp->list_node, &pool->conn_list);
-    write_unlock(&table->lock);
-    up(&pool->conn_sem);
+    __table_write_unlock(table, locked);
+    // make it ready, or hand it straight to a parked getter
+    handed = __connection_pool_release(pool, connp);
+    CONN_TRACE(table, TRACE_INSERT, connp, CONN_DOWN,
+        handed ? CONN_ACTIVE : CONN_READY, 0, 0);
 
     if (new_pool)
         pr_info("new connection pool "POOL_FMT"\n", POOL_ARGS(pool));
@@ -356,7 +1540,8 @@ static int connectionpool_hashtable_insert(struct cacheobj_conntable *table,
 
 /*
  * remove helper, no lock version
- * returns 0 on success or err if connection is either active or in retry
+ * returns 0 on success or err if connection is either active, in retry or
+ * its ready count is claimed by a getter
  * note: caller must have table write lock
  * We need to take lock for the entire routine to cover cases, where a reader
  * does a get while the remove attempt get past the conn in use check
@@ -364,6 +1549,7 @@ static int connectionpool_hashtable_insert(struct cacheobj_conntable *table,
 static inline int __connection_remove(struct cacheobj_conntable *table,
     struct cacheobj_connection_node *connp, bool have_lock)
 {
+    u64 locked;
     int err;
     unsigned long state, old;
     struct cacheobj_connection_pool *pool;
@@ -379,9 +1565,24 @@ static inline int __connection_remove(struct cacheobj_conntable *table,
         goto remove_error;
     }
 
+    /*
+     * a ready connection is accounted in the pool semaphore. take its count
+     * before it leaves the getters' view, or a getter holding that count
+     * finds no ready connection. never sleeps, caller may have table lock.
+     */
+    if ((state == CONN_READY) && down_trylock(&pool->conn_sem)) {
+        err = -EBUSY;
+        pr_err("conn is claimed by a getter, cannot destroy!\n");
+        goto remove_error;
+    }
+
     // moment of thruth. terminal state for connection
     old = atomic_long_cmpxchg(&connp->state, state, CONN_ZOMBIE);
     if (old != state) {
+        // count belongs to another ready connection now, or to the put
+        // of the getter that took this one, which also serves parked ones
+        if (state == CONN_READY)
+            up(&pool->conn_sem);
         err = -EAGAIN;
         pr_err("conn state changed, cannot destroy!\n");
         goto remove_error;
@@ -389,14 +1590,16 @@ static inline int __connection_remove(struct cacheobj_conntable *table,
 
     if (have_lock) {
         list_del(&connp->list_node);
+        __connection_affinity_clear(pool, connp);
     } else {
-        write_lock(&table->lock);
+        locked = __table_write_lock(table);
         list_del(&connp->list_node);
-        write_unlock(&table->lock);
+        __connection_affinity_clear(pool, connp);
+        __table_write_unlock(table, locked);
     }
-    down(&pool->conn_sem);
 
     connp->pool = NULL; // uncache
+    CONN_TRACE(table, TRACE_REMOVE, connp, state, CONN_ZOMBIE, 0, 0);
     pr_debug("removed connection from pool "CONN_FMT"\n", CONN_ARGS(connp));
     return 0;
 
@@ -423,22 +1626,23 @@ static int connectionpool_hashtable_remove(struct cacheobj_conntable
 static struct cacheobj_connection_node *connectionpool_hashtable_lookup
     (struct cacheobj_conntable *table, const char *ip, unsigned int port)
 {
+    u64 locked;
     u32 key = 0;
     struct cacheobj_connection_pool *pool;
     struct cacheobj_connection_node *connp = NULL;
 
-    if (ipv4_hash32(ip, port, &key) < 0)
+    if (ipv4_hash32(table, ip, port, &key) < 0)
         return ERR_PTR(-EINVAL);
 
-    read_lock(&table->lock);
+    locked = __table_read_lock(table);
     pool = __get_connection_pool(table, ip, port, key);
     if (pool && !list_empty(&pool->conn_list)) {
         connp = list_first_entry(&pool->conn_list,
                 struct cacheobj_connection_node, list_node);
-        read_unlock(&table->lock);
+        __table_read_unlock(table, locked);
         return connp;
     }
-    read_unlock(&table->lock);
+    __table_read_unlock(table, locked);
     return NULL;
 }
 
@@ -449,94 +1653,151 @@ static struct cacheobj_connection_node *connectionpool_hashtable_lookup
 static struct cacheobj_connection_node *connectionpool_hashtable_iter
     (struct cacheobj_conntable *table)
 {
+    u64 locked;
     int bkt = 0;
     struct cacheobj_connection_pool *pool;
     struct cacheobj_connection_node *connp = NULL;
 
-    read_lock(&table->lock);
+    locked = __table_read_lock(table);
     hash_for_each(table->buckets, bkt, pool, hentry) {
         if (!list_empty(&pool->conn_list)) {
             connp = list_first_entry(&pool->conn_list,
                     struct cacheobj_connection_node, list_node);
-            read_unlock(&table->lock);
+            __table_read_unlock(table, locked);
             return connp;
         }
     }
-    read_unlock(&table->lock);
+    __table_read_unlock(table, locked);
     return NULL;
 }
 
 /*
- * get a ready connection.
+ * get a ready connection, optionally leased for lease jiffies.
  * -may suspend current task if pool is busy
+ * -with CONNTABLE_AFFINITY, connection last used on this cpu is tried first
+ * -with CONNTABLE_HANDOFF, a busy pool parks the caller until a put hands
+ *  over its connection, instead of waking it to rescan the pool
+ * -with timeout GET_NOWAIT never sleeps, for softirq and atomic callers
  * returns:
  *	locked connection on success
  *	 NULL on no entry
  *	-EINVAL on bad input
- *	-EBUSY on resource busy
+ *	-EBUSY on resource busy or pool over its rate limit
+ *	-EAGAIN on no ready connection, with GET_NOWAIT
  *	-EPIPE on all paths down
  * Intention was to have a timed wait. But did not find wakit_event variant
  * for exclusive process. We may have to write one. (TBD)
  */
-static struct cacheobj_connection_node* connection_timed_get
+static struct cacheobj_connection_node* __connection_get
     (struct cacheobj_conntable *table, const char *ip, unsigned int port,
-    long timeout)
+    long timeout, unsigned long lease, const struct conn_hedge *hedge)
 {
-    u32 key;
-    bool apd;
+    u64 locked;
+    u32 key, hkey = 0;
+    bool apd, woken = false;
     int err = 0;
-    ktime_t now_ns;
-    unsigned long state;
-    struct cacheobj_connection_pool *pool;
+    ktime_t now_ns, wake_ns;
+    u64 sem_start, slow_paths;
+    unsigned long state, prev_state = CONN_READY;
+    struct cacheobj_connection_pool *pool, *hpool = NULL, *from, *wpool;
     struct cacheobj_connection_node *connp;
 
-    if (ipv4_hash32(ip, port, &key) < 0) {
+    if ((ipv4_hash32(table, ip, port, &key) < 0) ||
+        (hedge && (ipv4_hash32(table, hedge->ip, hedge->port, &hkey) < 0))) {
         err = -EINVAL;
         goto exit;
     }
 
     cacheobjects_stat64_ktime(&now_ns); // start wait time
 
-    read_lock(&table->lock);
+    locked = __table_read_lock(table);
 
     pool = __get_connection_pool(table, ip, port, key);
     if (!pool || list_empty(&pool->conn_list)) {
-        read_unlock(&table->lock);
+        __table_read_unlock(table, locked);
         err = -ENOENT;
         pr_debug("connection not found (%s:%u)\n", ip, port);
         goto exit;
     }
+    wpool = pool; // stalls are charged to the pool asked for
+    slow_paths = cacheobjects_stat64_read(&pool->nr_slow_paths);
+
+    if (!__connection_pool_admit(pool)) {
+        __table_read_unlock(table, locked);
+        cacheobjects_stat64(&pool->nr_throttled_gets);
+        err = -EBUSY;
+        goto exit;
+    }
 
     if (down_trylock(&pool->conn_sem)) {
-        read_unlock(&table->lock);
+        if (timeout == GET_NOWAIT) {
+            __table_read_unlock(table, locked);
+            cacheobjects_stat64(&pool->nr_try_misses);
+            err = -EAGAIN;
+            goto exit;
+        }
+        // hedging rides on hand-off, a getter can only be parked on pools
+        if (hedge) {
+            hpool = __get_connection_pool(table, hedge->ip, hedge->port, hkey);
+            if (hpool && ((hpool == pool) || list_empty(&hpool->conn_list)))
+                hpool = NULL;
+        }
+        __table_read_unlock(table, locked);
         cacheobjects_stat64(&pool->nr_slow_paths);
-        err = down_timeout(&pool->conn_sem, timeout);
+        atomic_inc(&wpool->nr_waiters);
+        __pool_pressure(table, wpool, 1, 0);
+        sem_start = ktime_get_ns();
+        if (hpool) {
+            connp = __connection_pool_hedged_wait(pool, hpool, timeout,
+                    __connection_hedge_after(pool, hedge), &wake_ns, &from,
+                    &err);
+            if (from != pool) {
+                cacheobjects_stat64(&pool->nr_hedge_wins);
+                pool = from;
+            }
+        } else if (table->flags & CONNTABLE_HANDOFF) {
+            connp = __connection_pool_wait(pool, timeout, &wake_ns, &err);
+        } else {
+            connp = NULL;
+            err = down_timeout(&pool->conn_sem, timeout);
+#ifdef CONFIG_CACHEOBJS_STATS
+            // approximate, the put that woke us may not be the last one
+            wake_ns = pool->last_release_ns;
+#endif
+        }
+        atomic_dec(&wpool->nr_waiters);
+        __pool_pressure(table, wpool, -1, 0);
+        __lock_stat_waited(table, LOCK_POOL_SEM, ktime_get_ns() - sem_start);
         if (err) {
             pr_err("get connection timed out "POOL_FMT"\n", POOL_ARGS(pool));
             goto exit;
         }
-        read_lock(&table->lock);
+        woken = true;
+        locked = __table_read_lock(table);
+        if (connp) {
+            prev_state = CONN_ACTIVE; // handed off, never became ready
+            goto found;
+        }
     }
 
+    // fast path, reuse connection warm on this cpu
+    if ((table->flags & CONNTABLE_AFFINITY) &&
+        (connp = __connection_affinity_get(pool)))
+        goto found;
+
     apd = true;
     list_for_each_entry(connp, &pool->conn_list, list_node) {
         // grab ready connection
         if (((state = atomic_long_read(&connp->state)) == CONN_READY) &&
             (atomic_long_cmpxchg(&connp->state, CONN_READY, CONN_ACTIVE)
                 == CONN_READY)) {
-            read_unlock(&table->lock);
-            // stats
-            cacheobjects_stat64_add(ktime_ns_delta(ktime_get(),
-                now_ns), &connp->cum_wait_ns); // end wait time
-            cacheobjects_stat64_ktime(&connp->now_ns); // start use time
-            cacheobjects_stat64(&connp->nr_lookups);
-            return connp;
+            goto found;
         } else if ((state != CONN_FAILED) && (state != CONN_RETRY)) {
             apd = false;
         }
     }
 
-    read_unlock(&table->lock);
+    __table_read_unlock(table, locked);
 
     if (!apd)
         CONNTBL_ASSERT(0);
@@ -544,26 +1805,676 @@ static struct cacheobj_connection_node* connection_timed_get
     err = -EHOSTDOWN;
     pr_err("get connection node failed "POOL_FMT", all paths down "
         "to node!", POOL_ARGS(pool));
+    goto exit;
+
+found:
+    __lock_stat_acquired(table, LOCK_POOL_SEM);
+    __pool_pressure(table, pool, 0, 1);
+    if (table->flags & CONNTABLE_AFFINITY)
+        __connection_affinity_set(pool, connp);
+    __table_read_unlock(table, locked);
+    __connection_lease_start(connp, lease);
+    // stats
+    cacheobjects_stat64_add(ktime_ns_delta(ktime_get(),
+        now_ns), &connp->cum_wait_ns); // end wait time
+    cacheobjects_stat64_ktime(&connp->now_ns); // start use time
+    cacheobjects_stat64(&connp->nr_lookups);
+    cacheobjects_hist_add(&pool->wait_hist, ktime_ns_delta(connp->now_ns,
+        now_ns));
+    if (woken) {
+        cacheobjects_stat64(&pool->nr_wakeups);
+        cacheobjects_stat64_add(ktime_ns_delta(connp->now_ns, wake_ns),
+            &pool->cum_wake_ns);
+    }
+    CONN_TRACE(table, TRACE_GET, connp, prev_state, CONN_ACTIVE,
+        ktime_ns_delta(connp->now_ns, now_ns), 0);
+    __pool_topk_get(table, connp->pool, ktime_ns_delta(connp->now_ns,
+        now_ns));
+    CONN_OUTLIER(table, TRACE_GET, wpool, connp,
+        ktime_ns_delta(connp->now_ns, now_ns), slow_paths);
+#ifdef CONFIG_CACHEOBJS_STATS
+    connp->slow_paths_at_get = cacheobjects_stat64_read(&wpool->nr_slow_paths);
+#endif
+    return connp;
+
 exit:
     return (err == -ENOENT) ? NULL : ERR_PTR(err);
 }
 
+static struct cacheobj_connection_node* connection_timed_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+    long timeout)
+{
+    return __connection_get(table, ip, port, timeout, 0, NULL);
+}
+
+/*
+ * get a ready connection without sleeping, safe from softirq and atomic
+ * context. returns -EAGAIN if none is ready.
+ * note: table writers disable bottom halves, so readers may nest in softirq
+ */
+static struct cacheobj_connection_node* connection_try_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port)
+{
+    return __connection_get(table, ip, port, GET_NOWAIT, 0, NULL);
+}
+
 /*
- * puts a connection after use
- * -unlock connection and notify one waiting on pool wq
+ * get a ready connection, holder is reported by the watchdog (and its
+ * connection recycled with CONNTABLE_LEASE_RECYCLE) once lease expires.
+ * note: leased connections must be put by the task which got them
+ */
+static struct cacheobj_connection_node* connection_leased_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+    long timeout, unsigned long lease)
+{
+    return __connection_get(table, ip, port, timeout, lease, NULL);
+}
+
+/*
+ * hedged get, for tail sensitive callers. if the primary pool is busy for
+ * hedge_after jiffies (0 for its p95 wait), the secondary pool is raced
+ * against it and whichever serves first is returned.
+ * returns as a timed get, or -EOPNOTSUPP without CONNTABLE_HANDOFF, as only
+ * a getter parked on its pools can be served by either.
+ */
+static struct cacheobj_connection_node* connection_hedged_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+    const char *hedge_ip, unsigned int hedge_port, long timeout,
+    long hedge_after)
+{
+    struct conn_hedge hedge = {
+        .ip = hedge_ip,
+        .port = hedge_port,
+        .after = hedge_after,
+    };
+
+    if (!(table->flags & CONNTABLE_HANDOFF))
+        return ERR_PTR(-EOPNOTSUPP);
+    return __connection_get(table, ip, port, timeout, 0, &hedge);
+}
+
+/*
+ * create a replica group over ip:port pools and register it with the table.
+ * pools need not exist yet, they are resolved on every group get.
+ */
+static struct cacheobj_replica_group *connectionpool_group_create
+    (struct cacheobj_conntable *table, const char **ip,
+    const unsigned int *port, unsigned int nr_replicas)
+{
+    u64 locked;
+    u32 key;
+    unsigned int i;
+    struct cacheobj_replica_group *group;
+
+    if (!nr_replicas || (nr_replicas > MAX_REPLICAS))
+        return ERR_PTR(-EINVAL);
+
+    group = kzalloc(sizeof(struct cacheobj_replica_group), GFP_KERNEL);
+    if (!group)
+        return ERR_PTR(-ENOMEM);
+
+    for (i = 0; i < nr_replicas; i++) {
+        if ((ipv4_hash32(table, ip[i], port[i], &key) < 0) ||
+            (strlen(ip[i]) >= INET_ADDRSTRLEN)) {
+            kfree(group);
+            return ERR_PTR(-EINVAL);
+        }
+        strcpy(group->replicas[i].ip, ip[i]);
+        group->replicas[i].port = port[i];
+    }
+    group->nr_replicas = nr_replicas;
+    INIT_LIST_HEAD(&group->list);
+    cacheobjects_stat64_reset(&group->nr_gets);
+    cacheobjects_stat64_reset(&group->nr_fallbacks);
+
+    locked = __table_write_lock(table);
+    list_add_tail(&group->list, &table->groups);
+    __table_write_unlock(table, locked);
+    return group;
+}
+
+/*
+ * unregister and free a replica group
+ * note: caller must ensure there are no group gets in flight
+ */
+static void connectionpool_group_destroy(struct cacheobj_conntable *table,
+    struct cacheobj_replica_group *group)
+{
+    u64 locked;
+    locked = __table_write_lock(table);
+    list_del(&group->list);
+    __table_write_unlock(table, locked);
+    kfree(group);
+}
+
+/*
+ * compare load of two replicas, more free connections wins and fewer
+ * parked getters breaks the tie. missing pools always lose.
+ * returns true if replica a is the better pick
+ */
+static bool __replica_less_loaded(struct cacheobj_conntable *table,
+    struct cacheobj_replica_group *group, unsigned int a, unsigned int b)
+{
+    u64 locked;
+    u32 key;
+    unsigned int i, idx[2] = { a, b };
+    long free[2] = { -1, -1 }, waiters[2] = { 0, 0 };
+    struct cacheobj_connection_pool *pool;
+
+    locked = __table_read_lock(table);
+    for (i = 0; i < 2; i++) {
+        if (ipv4_hash32(table, group->replicas[idx[i]].ip,
+                group->replicas[idx[i]].port, &key) < 0)
+            continue;
+        pool = __get_connection_pool(table, group->replicas[idx[i]].ip,
+                group->replicas[idx[i]].port, key);
+        if (!pool)
+            continue;
+        free[i] = READ_ONCE(pool->conn_sem.count);
+        waiters[i] = atomic_read(&pool->nr_waiters);
+    }
+    __table_read_unlock(table, locked);
+
+    if (free[0] != free[1])
+        return free[0] > free[1];
+    return waiters[0] <= waiters[1];
+}
+
+/*
+ * get a ready connection from any replica of the group.
+ * -pick the less loaded of two random replicas (power of two choices)
+ * -on -EHOSTDOWN or missing pool, fall back to the remaining replicas
+ * returns connection, or error of the last replica tried
+ */
+static struct cacheobj_connection_node* connection_group_get
+    (struct cacheobj_conntable *table, struct cacheobj_replica_group *group,
+    long timeout)
+{
+    unsigned int i, a, b, first, n = group->nr_replicas;
+    unsigned long tried = 0;
+    struct cacheobj_connection_node *connp;
+
+    cacheobjects_stat64(&group->nr_gets);
+
+    first = 0;
+    if (n > 1) {
+        a = get_random_u32_below(n);
+        b = get_random_u32_below(n - 1);
+        if (b >= a)
+            b++;
+        first = __replica_less_loaded(table, group, a, b) ? a : b;
+    }
+
+    for (i = first; ; i = ((i + 1) % n)) {
+        if (tried & (1UL << i))
+            break;
+        tried |= (1UL << i);
+
+        connp = __connection_get(table, group->replicas[i].ip,
+                group->replicas[i].port, timeout, 0, NULL);
+        if (!IS_ERR_OR_NULL(connp)) {
+            if (i != first)
+                cacheobjects_stat64(&group->nr_fallbacks);
+            return connp;
+        }
+        if (connp && (PTR_ERR(connp) != -EHOSTDOWN))
+            break;
+    }
+    return connp;
+}
+
+/*
+ * get a ready connection from the pool owning an object key on the
+ * consistent hash ring. returns NULL if the table has no pools.
+ */
+static struct cacheobj_connection_node* connection_key_get
+    (struct cacheobj_conntable *table, const void *key, size_t len,
+    long timeout)
+{
+    unsigned int i, port;
+    char ip[INET_ADDRSTRLEN];
+    struct cacheobj_hash_ring *ring;
+    u32 hash = jhash(key, len, 0);
+
+    __conntable_ring_sync(table);
+    rcu_read_lock();
+    ring = rcu_dereference(table->ring);
+    if (!ring) {
+        rcu_read_unlock();
+        return NULL;
+    }
+    i = __conntable_ring_locate(ring, hash);
+    memcpy(ip, ring->nodes[i].ip, INET_ADDRSTRLEN);
+    port = ring->nodes[i].port;
+    rcu_read_unlock();
+
+    return __connection_get(table, ip, port, timeout, 0, NULL);
+}
+
+/*
+ * account bytes moved on an active connection against its pool byte limit
+ * returns 0, or -EBUSY if the pool is over budget and caller should back off
+ */
+static int connection_account(struct cacheobj_conntable *table,
+    struct cacheobj_connection_node *connp, size_t tx, size_t rx)
+{
+    struct cacheobj_connection_pool *pool = connp->pool;
+
+    cacheobjects_stat64_add(tx, &connp->tx_bytes);
+    cacheobjects_stat64_add(rx, &connp->rx_bytes);
+#ifdef CONFIG_CACHEOBJS_STATS
+    if (conntable_topk_sample(&table->topk))
+        __conntable_topk_add(&table->topk, TOPK_BYTES, pool->key, pool->ip,
+            pool->port, tx + rx);
+#endif
+    if (!__token_bucket_charge(&pool->bytes_limit, tx + rx)) {
+        cacheobjects_stat64(&pool->nr_throttled_bytes);
+        return -EBUSY;
+    }
+    return 0;
+}
+
+/*
+ * set pool rate limits, 0 for unlimited
+ */
+static int connectionpool_hashtable_ratelimit(struct cacheobj_conntable
+    *table, const char *ip, unsigned int port, u64 ops_per_sec,
+    u64 bytes_per_sec)
+{
+    u64 locked;
+    u32 key;
+    struct cacheobj_connection_pool *pool;
+
+    if (ipv4_hash32(table, ip, port, &key) < 0)
+        return -EINVAL;
+
+    locked = __table_read_lock(table);
+    pool = __get_connection_pool(table, ip, port, key);
+    if (pool) {
+        __token_bucket_init(&pool->ops_limit, ops_per_sec);
+        __token_bucket_init(&pool->bytes_limit, bytes_per_sec);
+    }
+    __table_read_unlock(table, locked);
+    return pool ? 0 : -ENOENT;
+}
+
+/*
+ * allocate and initialize a node owned by the table, backed by the reserve
+ * so a reconnect to an existing pool always makes progress
+ */
+static struct cacheobj_connection_node *connectionpool_node_alloc
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port)
+{
+    int err;
+    struct cacheobj_connection_node *connp;
+
+    connp = (struct cacheobj_connection_node *)__conntable_reserve_alloc
+        (table, table->node_reserve, sizeof(struct cacheobj_connection_node));
+    err = cacheobj_connection_node_init(connp, ip, port);
+    if (err) {
+        __conntable_reserve_free(table->node_reserve, connp);
+        return ERR_PTR(err);
+    }
+    connp->flags |= CONN_NODE_TABLE_ALLOC;
+    return connp;
+}
+
+/*
+ * free a node from node_alloc, which must be removed from the table
+ */
+static void connectionpool_node_free(struct cacheobj_conntable *table,
+    struct cacheobj_connection_node *connp)
+{
+    CONNTBL_ASSERT(connp->flags & CONN_NODE_TABLE_ALLOC);
+    cacheobj_connection_node_destroy(connp);
+    __conntable_reserve_free(table->node_reserve, connp);
+}
+
+/*
+ * free a pool built by bulk load which was never published, with its nodes
+ */
+static void __bulk_pool_free(struct cacheobj_conntable *table,
+    struct cacheobj_connection_pool *pool)
+{
+    struct cacheobj_connection_node *connp, *tmp;
+
+    list_for_each_entry_safe(connp, tmp, &pool->conn_list, list_node) {
+        list_del(&connp->list_node);
+        cacheobj_connection_node_destroy(connp);
+        __conntable_reserve_free(table->node_reserve, connp);
+    }
+    __connection_pool_free(table, pool);
+}
+
+#ifdef CONFIG_CACHEOBJS_STATS
+static stat64_t *__snap_pool_stat(struct cacheobj_connection_pool *pool,
+    conntable_topo_stat_t stat)
+{
+    switch (stat) {
+    case TOPO_STAT_SLOW_PATHS:
+        return &pool->nr_slow_paths;
+    case TOPO_STAT_AFFINITY_HITS:
+        return &pool->nr_affinity_hits;
+    case TOPO_STAT_AFFINITY_MISSES:
+        return &pool->nr_affinity_misses;
+    case TOPO_STAT_HANDOFFS:
+        return &pool->nr_handoffs;
+    case TOPO_STAT_WAKEUPS:
+        return &pool->nr_wakeups;
+    case TOPO_STAT_WAKE_NS:
+        return &pool->cum_wake_ns;
+    case TOPO_STAT_LEASE_EXPIRED:
+        return &pool->nr_lease_expired;
+    case TOPO_STAT_LEASE_RECYCLED:
+        return &pool->nr_lease_recycled;
+    case TOPO_STAT_STALE_PUTS:
+        return &pool->nr_stale_puts;
+    case TOPO_STAT_HEDGES:
+        return &pool->nr_hedges;
+    case TOPO_STAT_HEDGE_WINS:
+        return &pool->nr_hedge_wins;
+    case TOPO_STAT_THROTTLED_GETS:
+        return &pool->nr_throttled_gets;
+    case TOPO_STAT_THROTTLED_BYTES:
+        return &pool->nr_throttled_bytes;
+    case TOPO_STAT_TRY_MISSES:
+        return &pool->nr_try_misses;
+    default:
+        return NULL;
+    }
+}
+
+static stat64_t *__snap_conn_stat(struct cacheobj_connection_node *connp,
+    conntable_topo_stat_t stat)
+{
+    switch (stat) {
+    case TOPO_STAT_LOOKUPS:
+        return &connp->nr_lookups;
+    case TOPO_STAT_GET_NS:
+        return &connp->cum_get_ns;
+    case TOPO_STAT_PUT_NS:
+        return &connp->cum_put_ns;
+    case TOPO_STAT_WAIT_NS:
+        return &connp->cum_wait_ns;
+    case TOPO_STAT_TX_BYTES:
+        return &connp->tx_bytes;
+    case TOPO_STAT_RX_BYTES:
+        return &connp->rx_bytes;
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * counters of a pool built from a snapshot record. the connection sums
+ * are spread evenly over its new connections, the first takes the rest.
+ */
+static void __bulk_pool_restore(struct cacheobj_connection_pool *pool,
+    unsigned int nr_conns, const struct conntable_topo_node_stats *stats)
+{
+    int stat;
+    u64 val;
+    struct cacheobj_connection_node *connp;
+
+    for (stat = 0; stat < TOPO_STAT_LOOKUPS; stat++)
+        atomic64_set(__snap_pool_stat(pool, stat),
+            le64_to_cpu(stats->stat[stat]));
+    if (!nr_conns)
+        return;
+    for (stat = TOPO_STAT_LOOKUPS; stat < NR_TOPO_STATS; stat++) {
+        val = le64_to_cpu(stats->stat[stat]);
+        list_for_each_entry(connp, &pool->conn_list, list_node)
+            atomic64_set(__snap_conn_stat(connp, stat), div_u64(val,
+                nr_conns));
+        connp = list_first_entry(&pool->conn_list,
+            struct cacheobj_connection_node, list_node);
+        cacheobjects_stat64_add(val - div_u64(val, nr_conns) * nr_conns,
+            __snap_conn_stat(connp, stat));
+    }
+}
+
+/* counters of a pool into its snapshot record */
+static void __snap_pool_stats(struct cacheobj_connection_pool *pool,
+    struct conntable_topo_node_stats *stats)
+{
+    int stat;
+    u64 sum;
+    struct cacheobj_connection_node *connp;
+
+    for (stat = 0; stat < TOPO_STAT_LOOKUPS; stat++)
+        stats->stat[stat] = cpu_to_le64(cacheobjects_stat64_read(
+            __snap_pool_stat(pool, stat)));
+    for (stat = TOPO_STAT_LOOKUPS; stat < NR_TOPO_STATS; stat++) {
+        sum = 0;
+        list_for_each_entry(connp, &pool->conn_list, list_node)
+            sum += cacheobjects_stat64_read(__snap_conn_stat(connp, stat));
+        stats->stat[stat] = cpu_to_le64(sum);
+    }
+}
+#else
+static inline void __bulk_pool_restore(struct cacheobj_connection_pool *pool,
+    unsigned int nr_conns, const struct conntable_topo_node_stats *stats)
+{
+}
+
+static inline void __snap_pool_stats(struct cacheobj_connection_pool *pool,
+    struct conntable_topo_node_stats *stats)
+{
+}
+#endif
+
+/*
+ * build the pool of a topology node privately: connections ready and
+ * counted in the semaphore, rate limits and any snapshot counters set,
+ * nothing shared touched
+ */
+static struct cacheobj_connection_pool *__bulk_pool_build
+    (struct cacheobj_conntable *table, const struct conntable_topo_node *node,
+     const struct conntable_topo_node_stats *stats)
+{
+    char ip[INET_ADDRSTRLEN];
+    __be32 addr = node->addr;
+    unsigned int i, port = le16_to_cpu(node->port),
+        nr_conns = le32_to_cpu(node->nr_conns);
+    struct cacheobj_connection_pool *pool;
+    struct cacheobj_connection_node *connp;
+
+    snprintf(ip, sizeof(ip), "%pI4", &addr);
+    pool = __connection_pool_alloc(table, ip, port, false);
+    if (IS_ERR(pool))
+        return pool;
+    pool->key = hashfn(table, addr, (__be32) port);
+    __token_bucket_init(&pool->ops_limit, le64_to_cpu(node->ops_per_sec));
+    __token_bucket_init(&pool->bytes_limit, le64_to_cpu(node->bytes_per_sec));
+
+    for (i = 0; i < nr_conns; i++) {
+        // plain allocations, the reserve is kept for reconnects
+        connp = kzalloc(sizeof(*connp), GFP_KERNEL);
+        if (!connp || cacheobj_connection_node_init(connp, ip, port)) {
+            kfree(connp);
+            __bulk_pool_free(table, pool);
+            return ERR_PTR(-ENOMEM);
+        }
+        connp->flags |= CONN_NODE_TABLE_ALLOC;
+        connp->pool = pool;
+        atomic_long_set(&connp->state, CONN_READY);
+        list_add(&connp->list_node, &pool->conn_list);
+    }
+    sema_init(&pool->conn_sem, nr_conns);
+    if (stats)
+        __bulk_pool_restore(pool, nr_conns, stats);
+    return pool;
+}
+
+/*
+ * load pools and connections of a topology blob. all of it is built
+ * before the table write lock is taken once to publish the new pools, and
+ * the hash ring is rebuilt once after. nodes whose pool is already in the
+ * table (or earlier in the blob) join it through plain insert, and keep
+ * their counters rather than take those of a snapshot. the table owns the
+ * nodes, as with node_alloc.
+ * returns 0, -EINVAL on a malformed blob or -ENOMEM with nothing loaded
+ */
+static int connectionpool_hashtable_bulk_load(struct cacheobj_conntable
+    *table, const void *blob, size_t len)
+{
+    u64 locked;
+    int err;
+    unsigned int i, nr_nodes, nr_new = 0;
+    struct cacheobj_connection_pool **pools, *pool;
+    struct cacheobj_connection_node *connp, *tmp;
+
+    err = conntable_topo_check(blob, len);
+    if (err)
+        return err;
+    nr_nodes = conntable_topo_nr_nodes(blob);
+    if (!nr_nodes)
+        return 0;
+
+    pools = kvmalloc_array(nr_nodes, sizeof(*pools), GFP_KERNEL);
+    if (!pools)
+        return -ENOMEM;
+    for (i = 0; i < nr_nodes; i++) {
+        pools[i] = __bulk_pool_build(table, conntable_topo_node(blob, i),
+            conntable_topo_stats(blob, i));
+        if (IS_ERR(pools[i])) {
+            err = PTR_ERR(pools[i]);
+            while (i--)
+                __bulk_pool_free(table, pools[i]);
+            kvfree(pools);
+            return err;
+        }
+    }
+
+    // publish, pools found already in the table are merged below
+    locked = __table_write_lock(table);
+    for (i = 0; i < nr_nodes; i++) {
+        pool = pools[i];
+        if (__get_connection_pool(table, pool->ip, pool->port, pool->key))
+            continue;
+        hash_add(table->buckets, &pool->hentry, pool->key);
+        table->nr_pools++;
+        nr_new++;
+        pools[i] = NULL;
+    }
+    __table_write_unlock(table, locked);
+
+    for (i = 0; i < nr_nodes; i++) {
+        if (!pools[i])
+            continue;
+        list_for_each_entry_safe(connp, tmp, &pools[i]->conn_list,
+                list_node) {
+            list_del(&connp->list_node);
+            connectionpool_hashtable_insert(table, connp);
+        }
+        __connection_pool_free(table, pools[i]);
+    }
+    kvfree(pools);
+
+    if (nr_new && __conntable_ring_rebuild(table))
+        pr_err("hash ring not updated after bulk load\n");
+    pr_info("bulk loaded %u nodes, new pools :%u\n", nr_nodes, nr_new);
+    return 0;
+}
+
+/*
+ * topology blob of the pools in the table, with the number of connections
+ * on their lists, rate limits and counters, which bulk_load restores. the
+ * blob is sized before the table read lock is taken, and again if pools
+ * were added.
+ * returns the kvmalloc'd blob, or ERR_PTR(-ENOMEM)
+ */
+static void *connectionpool_hashtable_snapshot(struct cacheobj_conntable
+    *table, size_t *len)
+{
+    u64 locked;
+    int bkt;
+    void *blob;
+    __be32 addr;
+    unsigned int nr_pools, nr_conns, i;
+    struct conntable_topo_snap_node *rec;
+    struct cacheobj_connection_pool *pool;
+    struct cacheobj_connection_node *connp;
+
+    nr_pools = READ_ONCE(table->nr_pools);
+    for (;;) {
+        blob = kvzalloc(conntable_topo_snap_len(nr_pools), GFP_KERNEL);
+        if (!blob)
+            return ERR_PTR(-ENOMEM);
+        locked = __table_read_lock(table);
+        if (table->nr_pools <= nr_pools)
+            break;
+        nr_pools = table->nr_pools;
+        __table_read_unlock(table, locked);
+        kvfree(blob);
+    }
+
+    i = 0;
+    rec = blob + sizeof(struct conntable_topo_hdr);
+    hash_for_each(table->buckets, bkt, pool, hentry) {
+        // only what a topology can name
+        if (!pool->port || (pool->port > U16_MAX) || (in4_pton(pool->ip,
+                strlen(pool->ip), (u8 *)&addr, '\0', NULL) != 1))
+            continue;
+        rec[i].node.addr = addr;
+        rec[i].node.port = cpu_to_le16(pool->port);
+        nr_conns = 0;
+        list_for_each_entry(connp, &pool->conn_list, list_node)
+            nr_conns++;
+        rec[i].node.nr_conns = cpu_to_le32(min_t(unsigned int, nr_conns,
+            CONNTABLE_TOPO_MAX_CONNS));
+        rec[i].node.ops_per_sec = cpu_to_le64(pool->ops_limit.rate);
+        rec[i].node.bytes_per_sec = cpu_to_le64(pool->bytes_limit.rate);
+        __snap_pool_stats(pool, &rec[i].stats);
+        i++;
+    }
+    __table_read_unlock(table, locked);
+
+    conntable_topo_snap_init(blob, i);
+    *len = conntable_topo_snap_len(i);
+    return blob;
+}
+
+/*
+ * puts a connection after use, does not sleep so safe in atomic context.
+ * op is the operation class, GET, PUT or an id from op_register
+ * -hand connection to oldest waiter, or mark it ready and up pool semaphore
  */
 static void connection_put(struct cacheobj_conntable *table,
     struct cacheobj_connection_node *connp, conn_op_t op)
 {
     unsigned long state;
 
+    CONNTBL_ASSERT((unsigned int)op < READ_ONCE(table->nr_op_classes));
+
+    if (!__connection_lease_end(connp)) {
+        // connection may have been removed since it was recycled
+        if (connp->pool)
+            cacheobjects_stat64(&connp->pool->nr_stale_puts);
+        pr_warn("put of revoked connection "CONN_FMT" by %s/%d ignored\n",
+            CONN_ARGS(connp), current->comm, task_pid_nr(current));
+        return;
+    }
+
     switch((state = atomic_long_read(&connp->state))) {
         case CONN_ACTIVE:
             {
                 struct cacheobj_connection_pool *pool = connp->pool;
+                s64 held = ktime_ns_delta(ktime_get(), connp->now_ns);
+                u64 slow_paths = 0;
+                bool handed;
+
+#ifdef CONFIG_CACHEOBJS_STATS
+                // connection may be handed to a new holder on release
+                slow_paths = connp->slow_paths_at_get;
+#endif
                 cacheobj_connection_node_update_ktime(connp, op); // end use time
-                atomic_long_cmpxchg(&connp->state, state, CONN_READY);
-                up(&pool->conn_sem);
+                handed = __connection_pool_release(pool, connp);
+                __pool_pressure(table, pool, 0, -1);
+                CONN_TRACE(table, TRACE_PUT, connp, CONN_ACTIVE,
+                    handed ? CONN_ACTIVE : CONN_READY, 0, held);
+                CONN_OUTLIER(table, TRACE_PUT, pool, connp, held, slow_paths);
                 break;
             }
         default:
@@ -571,19 +2482,85 @@ static void connection_put(struct cacheobj_conntable *table,
     }
 }
 
+/*
+ * lease watchdog, reports holders past their lease once and with
+ * CONNTABLE_LEASE_RECYCLE returns connections of exited holders to the pool
+ */
+static void connectionpool_watchdog_fn(struct work_struct *work)
+{
+    u64 locked;
+    int bkt, pid;
+    unsigned long lease, held, interval;
+    struct cacheobj_conntable *table = container_of(to_delayed_work(work),
+            struct cacheobj_conntable, watchdog);
+    struct cacheobj_connection_pool *pool;
+    struct cacheobj_connection_node *connp;
+
+    locked = __table_read_lock(table);
+    hash_for_each(table->buckets, bkt, pool, hentry) {
+        list_for_each_entry(connp, &pool->conn_list, list_node) {
+            if (atomic_long_read(&connp->state) != CONN_ACTIVE)
+                continue;
+
+            pid = atomic_read(&connp->holder_pid);
+            smp_rmb();
+            lease = READ_ONCE(connp->lease);
+            held = jiffies - READ_ONCE(connp->lease_start);
+            if ((pid <= 0) || !lease || (held <= (lease & ~LEASE_REPORTED)))
+                continue;
+
+            // report once per lease
+            if (!(lease & LEASE_REPORTED) && (cmpxchg(&connp->lease, lease,
+                    lease | LEASE_REPORTED) == lease)) {
+                cacheobjects_stat64(&pool->nr_lease_expired);
+                pr_warn("lease expired "CONN_FMT" holder %.*s/%d held %u ms "
+                    "lease %u ms\n", CONN_ARGS(connp), TASK_COMM_LEN,
+                    connp->holder_comm, pid, jiffies_to_msecs(held),
+                    jiffies_to_msecs(lease));
+            }
+
+            // a live holder keeps its connection until it exits
+            if ((table->flags & CONNTABLE_LEASE_RECYCLE) &&
+                __connection_holder_gone(pid) &&
+                __connection_lease_revoke(table, pool, connp, pid))
+                cacheobjects_stat64(&pool->nr_lease_recycled);
+        }
+    }
+    __table_read_unlock(table, locked);
+
+    interval = READ_ONCE(table->watchdog_interval);
+    if (interval)
+        schedule_delayed_work(&table->watchdog, interval);
+}
+
+/*
+ * start lease watchdog with a scan interval in jiffies, or stop it with 0
+ */
+static int connectionpool_hashtable_watchdog(struct cacheobj_conntable *table,
+    unsigned long interval)
+{
+    WRITE_ONCE(table->watchdog_interval, interval);
+    if (!interval)
+        cancel_delayed_work_sync(&table->watchdog);
+    else
+        mod_delayed_work(system_wq, &table->watchdog, interval);
+    return 0;
+}
+
 /*
  * clears connection table, protected
  */
 static int connectionpool_hashtable_destroy(struct cacheobj_conntable *table)
 {
+    u64 locked;
     int bkt;
     bool have_lock = true;
-    size_t nr_items = 0, pools_left = 0;
+    size_t nr_items = 0, pools_left = 0, pools_gone = 0;
     struct hlist_node *tmp;
     struct cacheobj_connection_pool *pool;
     struct cacheobj_connection_node *connp, *tmp_list;
 
-    write_lock(&table->lock);
+    locked = __table_write_lock(table);
     if (hash_empty(table->buckets))
         goto exit;
 
@@ -593,46 +2570,303 @@ static int connectionpool_hashtable_destroy(struct cacheobj_conntable *table)
         list_for_each_entry_safe(connp, tmp_list, &pool->conn_list, list_node) {
             if (__connection_remove(table, connp, have_lock) == 0) {
                 cacheobj_connection_node_destroy(connp);
+                if (connp->flags & CONN_NODE_TABLE_ALLOC)
+                    __conntable_reserve_free(table->node_reserve, connp);
                 nr_items++;
             }
         }
         if (list_empty(&pool->conn_list)) {
-            if (__connection_pool_destroy(pool) == 0)
+            if (__connection_pool_destroy(table, pool) == 0) {
                 pools_left--;
+                pools_gone++;
+                table->nr_pools--;
+            }
         }
     }
 
 exit:
-    write_unlock(&table->lock);
+    __table_write_unlock(table, locked);
+    if (pools_gone) {
+        if (__conntable_ring_rebuild(table))
+            pr_err("hash ring not updated after destroy\n");
+        // no ring left, wait for retired rings to be freed
+        if (!pools_left)
+            rcu_barrier();
+    }
     pr_debug("cleanup removed %lu items from table\n", nr_items);
     return pools_left ? -EBUSY : 0;
 }
 
+/*
+ * frees what init set up. destroy only clears the table, and may run any
+ * number of times while ops run, so none of it can go there.
+ * note: caller must have destroyed the table, and no op may run
+ */
+static void connectionpool_hashtable_exit(struct cacheobj_conntable *table)
+{
+    // the watchdog re-arms itself, stop it before what it touches goes
+    WRITE_ONCE(table->watchdog_interval, 0);
+    cancel_delayed_work_sync(&table->watchdog);
+    __conntable_reserve_destroy(table);
+#ifdef CONFIG_CACHEOBJS_STATS
+    free_percpu(table->lock_stats);
+    table->lock_stats = NULL;
+    conntrace_exit(&table->trace);
+    conntable_probe_stats_exit(table);
+    conntable_topk_exit(&table->topk);
+#endif
+}
+
+/*
+ * one section per operation class, with hold time of each pool which saw it
+ * note: caller must have table read lock
+ */
+static void __conntable_dump_op_classes(struct cacheobj_conntable *table,
+    struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    int bkt;
+    unsigned int i, nr_classes = smp_load_acquire(&table->nr_op_classes);
+    u64 nr_ops;
+    struct cacheobj_op_stats *ops;
+    struct cacheobj_connection_pool *pool;
+
+    for (i = 0; i < nr_classes; i++) {
+        seq_printf(m, "\nop class %u %s\n", i, table->op_classes[i]);
+        hash_for_each(table->buckets, bkt, pool, hentry) {
+            ops = __pool_op_stats_peek(pool, i);
+            nr_ops = ops ? cacheobjects_stat64_read(&ops->nr_ops) : 0;
+            if (!nr_ops)
+                continue;
+            seq_printf(m, "pool "POOL_FMT" ops :%llu avg_hold(ns) :%lu "
+                    "p50_hold(ns) :%llu p99_hold(ns) :%llu\n",
+                    POOL_ARGS(pool), nr_ops,
+                    div64_safe(cacheobjects_stat64_read(&ops->cum_hold_ns),
+                        nr_ops),
+                    cacheobjects_hist_percentile(&ops->hold_hist, 50),
+                    cacheobjects_hist_percentile(&ops->hold_hist, 99));
+        }
+    }
+#endif
+}
+
+/*
+ * pressure of a pool, or of the table for NULL ip
+ * returns 0, -ENOENT on no pool or -EOPNOTSUPP without stats
+ */
+static int connectionpool_hashtable_pressure(struct cacheobj_conntable
+    *table, const char *ip, unsigned int port,
+    struct cacheobj_pressure_stat *stat)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    u32 key;
+    u64 locked;
+    struct cacheobj_connection_pool *pool;
+
+    if (!ip) {
+        __pressure_snapshot(&table->pressure, stat);
+        return 0;
+    }
+
+    if (ipv4_hash32(table, ip, port, &key) < 0)
+        return -EINVAL;
+
+    locked = __table_read_lock(table);
+    pool = __get_connection_pool(table, ip, port, key);
+    if (pool)
+        __pressure_snapshot(&pool->pressure, stat);
+    __table_read_unlock(table, locked);
+    return pool ? 0 : -ENOENT;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * table and pool pressure, in /proc/pressure format
+ */
+static void connectionpool_hashtable_pressure_dump(struct cacheobj_conntable
+    *table, struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    int bkt;
+    u64 locked;
+    char name[INET_ADDRSTRLEN + 16];
+    struct cacheobj_connection_pool *pool;
+
+    __pressure_show(m, "table", &table->pressure);
+    locked = __table_read_lock(table);
+    hash_for_each(table->buckets, bkt, pool, hentry) {
+        snprintf(name, sizeof(name), "pool "POOL_FMT, POOL_ARGS(pool));
+        __pressure_show(m, name, &pool->pressure);
+    }
+    __table_read_unlock(table, locked);
+#endif
+}
+
+/*
+ * flight recorder events of all cpus
+ */
+static void connectionpool_hashtable_trace_dump(struct cacheobj_conntable
+    *table, struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    conntrace_dump(&table->trace, m);
+#endif
+}
+
+/*
+ * operations slower than the outlier threshold, with stack and pool state
+ */
+static void connectionpool_hashtable_outlier_dump(struct cacheobj_conntable
+    *table, struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    conntrace_outlier_dump(&table->trace, m);
+#endif
+}
+
+/*
+ * hottest pools by gets, wait and bytes
+ */
+static void connectionpool_hashtable_topk_dump(struct cacheobj_conntable
+    *table, struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    conntable_topk_dump(&table->topk, m);
+#endif
+}
+
+/*
+ * bucket chain lengths and lookup probes, chains copied out under the lock
+ */
+static void connectionpool_hashtable_bucket_dump(struct cacheobj_conntable
+    *table, struct seq_file *m)
+{
+    u64 locked;
+    unsigned int chain[MAX_BUCKETS];
+
+    locked = __table_read_lock(table);
+    conntable_bucket_chains(table, chain);
+    __table_read_unlock(table, locked);
+    conntable_bucket_report(table, chain, m);
+}
+
+/*
+ * per lock totals over all cpus, with share of contended acquisitions
+ */
+static void __conntable_dump_lock_stats(struct cacheobj_conntable *table,
+    struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    static const char * const names[NR_LOCK_STATS] = {
+        [LOCK_TABLE_READ] = "table_read",
+        [LOCK_TABLE_WRITE] = "table_write",
+        [LOCK_POOL_SEM] = "pool_sem",
+    };
+    int cpu, i;
+    u64 acquired, contended, wait_ns, hold_ns;
+    struct cacheobj_lock_stats *ls;
+
+    if (!table->lock_stats)
+        return;
+
+    for (i = 0; i < NR_LOCK_STATS; i++) {
+        acquired = contended = wait_ns = hold_ns = 0;
+        for_each_possible_cpu(cpu) {
+            ls = per_cpu_ptr(table->lock_stats, cpu);
+            acquired += READ_ONCE(ls->lock[i].nr_acquired);
+            contended += READ_ONCE(ls->lock[i].nr_contended);
+            wait_ns += READ_ONCE(ls->lock[i].cum_wait_ns);
+            hold_ns += READ_ONCE(ls->lock[i].cum_hold_ns);
+        }
+        seq_printf(m, "lock %s acquired :%llu contended :%llu "
+                "contention_rate :%lu%% avg_wait(ns) :%lu avg_hold(ns) :%lu\n",
+                names[i], acquired, contended,
+                div64_safe(contended * 100, acquired),
+                div64_safe(wait_ns, contended), div64_safe(hold_ns, acquired));
+    }
+#endif
+}
+
 /*
  * track cacheobj_connection_node usage distribution
  */
 static void connectionpool_hashtable_dump(struct cacheobj_conntable
         *table, struct seq_file *m)
 {
+    u64 locked;
     int bkt;
     struct hlist_node *tmp;
     unsigned long total, getus, putus, waitus;
-    u64 lookups, tx_mb, rx_mb;
+    u64 lookups, tx_mb, rx_mb, hits, misses, wakeups;
     struct cacheobj_connection_pool *pool;
     struct cacheobj_connection_node *connp, *tmp_list;
+    struct cacheobj_replica_group *group;
+    struct cacheobj_hash_ring *ring;
 
     seq_printf(m, "conntable stats version :%d\n\n", CONNTABLE_VERSION);
 
+    __conntable_ring_sync(table);
+    rcu_read_lock();
+    ring = rcu_dereference(table->ring);
+    if (ring)
+        seq_printf(m, "hash ring nodes :%u points :%u\n", ring->nr_nodes,
+                ring->nr_points);
+    rcu_read_unlock();
+
+    __conntable_dump_lock_stats(table, m);
+
+    if (table->node_reserve && table->pool_reserve)
+        seq_printf(m, "reserve nodes :%d/%d pools :%d/%d used :%llu "
+                "exhausted :%llu\n", READ_ONCE(table->node_reserve->curr_nr),
+                table->node_reserve->min_nr,
+                READ_ONCE(table->pool_reserve->curr_nr),
+                table->pool_reserve->min_nr,
+                cacheobjects_stat64_read(&table->nr_reserve_used),
+                cacheobjects_stat64_read(&table->nr_reserve_exhausted));
+
+    locked = __table_read_lock(table);
+    list_for_each_entry(group, &table->groups, list) {
+        seq_printf(m, "group "POOL_FMT" replicas :%u gets :%llu "
+                "fallbacks :%llu\n", group->replicas[0].ip,
+                group->replicas[0].port, group->nr_replicas,
+                cacheobjects_stat64_read(&group->nr_gets),
+                cacheobjects_stat64_read(&group->nr_fallbacks));
+    }
+    __table_read_unlock(table, locked);
+
     seq_printf(m, "HOST\tSTATE\tRETRIES\tLOOKUPS\tSLOWPATHS\tAVG_WAIT(ns)\t"
             "AVG_LAT_GET(ns)\tAVG_LAT_PUT(ns)\tSEND(kb) RCV(kb)\n");
 
-    read_lock(&table->lock);
+    locked = __table_read_lock(table);
     if (hash_empty(table->buckets))
         goto exit;
 
     hash_for_each_safe(table->buckets, bkt, tmp, pool, hentry) {
-        seq_printf(m, "pool <%s:%u> nr_slow_paths :%lu\n", pool->ip,
-                pool->port, atomic64_read(&pool->nr_slow_paths));
+        hits = cacheobjects_stat64_read(&pool->nr_affinity_hits);
+        misses = cacheobjects_stat64_read(&pool->nr_affinity_misses);
+        wakeups = cacheobjects_stat64_read(&pool->nr_wakeups);
+        seq_printf(m, "pool <%s:%u> nr_slow_paths :%lu affinity_hits :%llu "
+                "affinity_misses :%llu affinity_hit_rate :%lu%% handoffs :%llu "
+                "wakeups :%llu avg_wake_to_acquire(ns) :%lu lease_expired :%llu "
+                "lease_recycled :%llu stale_puts :%llu hedges :%llu "
+                "hedge_wins :%llu p95_wait(ns) :%llu throttled_gets :%llu "
+                "throttled_bytes :%llu try_misses :%llu\n", pool->ip,
+                pool->port, atomic64_read(&pool->nr_slow_paths), hits, misses,
+                div64_safe(hits * 100, hits + misses),
+                cacheobjects_stat64_read(&pool->nr_handoffs), wakeups,
+                div64_safe(cacheobjects_stat64_read(&pool->cum_wake_ns),
+                    wakeups),
+                cacheobjects_stat64_read(&pool->nr_lease_expired),
+                cacheobjects_stat64_read(&pool->nr_lease_recycled),
+                cacheobjects_stat64_read(&pool->nr_stale_puts),
+                cacheobjects_stat64_read(&pool->nr_hedges),
+                cacheobjects_stat64_read(&pool->nr_hedge_wins),
+                cacheobjects_hist_percentile(&pool->wait_hist, 95),
+                cacheobjects_stat64_read(&pool->nr_throttled_gets),
+                cacheobjects_stat64_read(&pool->nr_throttled_bytes),
+                cacheobjects_stat64_read(&pool->nr_try_misses));
         list_for_each_entry_safe(connp, tmp_list, &pool->conn_list,
                 list_node) {
             lookups = cacheobjects_stat64_read(&connp->nr_lookups);
@@ -651,19 +2885,42 @@ static void connectionpool_hashtable_dump(struct cacheobj_conntable
                     putus, tx_mb, rx_mb);
         }
     }
+    __conntable_dump_op_classes(table, m);
 exit:
-    read_unlock(&table->lock);
+    __table_read_unlock(table, locked);
 }
 
 const struct cacheobj_conntable_operations cacheobj_conntable_ops =
 {
     .cacheobj_conntable_init = connectionpool_hashtable_init,
     .cacheobj_conntable_destroy = connectionpool_hashtable_destroy,
+    .cacheobj_conntable_exit = connectionpool_hashtable_exit,
     .cacheobj_conntable_insert = connectionpool_hashtable_insert,
     .cacheobj_conntable_remove = connectionpool_hashtable_remove,
     .cacheobj_conntable_lookup = connectionpool_hashtable_lookup,
     .cacheobj_conntable_iter = connectionpool_hashtable_iter,
     .cacheobj_conntable_timed_get = connection_timed_get,
+    .cacheobj_conntable_try_get = connection_try_get,
+    .cacheobj_conntable_op_register = connectionpool_op_register,
+    .cacheobj_conntable_pressure = connectionpool_hashtable_pressure,
+    .cacheobj_conntable_pressure_dump = connectionpool_hashtable_pressure_dump,
+    .cacheobj_conntable_trace_dump = connectionpool_hashtable_trace_dump,
+    .cacheobj_conntable_outlier_dump = connectionpool_hashtable_outlier_dump,
+    .cacheobj_conntable_bucket_dump = connectionpool_hashtable_bucket_dump,
+    .cacheobj_conntable_topk_dump = connectionpool_hashtable_topk_dump,
+    .cacheobj_conntable_bulk_load = connectionpool_hashtable_bulk_load,
+    .cacheobj_conntable_snapshot = connectionpool_hashtable_snapshot,
+    .cacheobj_conntable_leased_get = connection_leased_get,
     .cacheobj_conntable_put = connection_put,
-    .cacheobj_conntable_dump = connectionpool_hashtable_dump
+    .cacheobj_conntable_dump = connectionpool_hashtable_dump,
+    .cacheobj_conntable_watchdog = connectionpool_hashtable_watchdog,
+    .cacheobj_conntable_group_create = connectionpool_group_create,
+    .cacheobj_conntable_group_destroy = connectionpool_group_destroy,
+    .cacheobj_conntable_group_get = connection_group_get,
+    .cacheobj_conntable_key_get = connection_key_get,
+    .cacheobj_conntable_hedged_get = connection_hedged_get,
+    .cacheobj_conntable_account = connection_account,
+    .cacheobj_conntable_ratelimit = connectionpool_hashtable_ratelimit,
+    .cacheobj_conntable_node_alloc = connectionpool_node_alloc,
+    .cacheobj_conntable_node_free = connectionpool_node_free
 };
@@ -21,20 +21,55 @@
 #include <linux/inet.h>
 #include <linux/jhash.h>
 #include <linux/semaphore.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/mempool.h>
+#include <linux/static_call.h>
+#include <linux/random.h>
+#include <linux/version.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 
+#include "stat.h"
+#include "conntrace.h"
+#include "conntable_hash.h"
+#include "conntable_topk.h"
+#include "conntable_topo.h"
+
+/* prandom_u32_max was replaced by get_random_u32_below in 6.2 */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define get_random_u32_below(ceil) prandom_u32_max(ceil)
+#endif
+
 #define MAX_BUCKETS 64
 #define MAX_BUCKET_BITS ilog2(MAX_BUCKETS)
 
 typedef atomic64_t stat64_t;
 
+/*
+ * operation classes a connection is put with. GET and PUT are predefined,
+ * further classes get ids from MAX_OP_TYPE on, via op_register.
+ */
 typedef enum conn_op {
     GET=0,
     PUT,
     MAX_OP_TYPE
 }conn_op_t;
 
+#define MAX_OP_CLASSES 16
+#define OP_CLASS_NAME_LEN 16
+
+/* per pool stats of an operation class */
+struct cacheobj_op_stats {
+    stat64_t            nr_ops;
+    stat64_t            cum_hold_ns; // get to put
+    struct cacheobjects_hist hold_hist;
+};
+
 #define CONN_STATE_ENTRIES \
     X(0, CONN_DOWN, DOWN) \
     X(1, CONN_READY, READY) \
@@ -60,24 +95,95 @@ static inline const char *conn_state_status(enum conn_state state)
     }
 }
 
+/* pressure stall windows, averaged every PRESSURE_PERIOD like psi */
+enum { PRESSURE_SOME = 0, PRESSURE_FULL, NR_PRESSURE_STATES };
+enum { PRESSURE_AVG10 = 0, PRESSURE_AVG60, PRESSURE_AVG300,
+    NR_PRESSURE_WINDOWS };
+
+/*
+ * share of time callers stalled on pools. some: at least one caller waited
+ * for a connection, full: callers waited and none held a connection.
+ * state only changes when waiting or holding counts cross zero.
+ */
+struct cacheobj_pressure {
+    spinlock_t          lock; // protects all below the counts
+    atomic_t            nr_waiting;
+    atomic_t            nr_holding;
+    bool                state[NR_PRESSURE_STATES];
+    u64                 state_ns;  // start of current state
+    u64                 total[NR_PRESSURE_STATES]; // stall time in ns
+    u64                 avg_ns;    // time of last averaging
+    u64                 avg_total[NR_PRESSURE_STATES]; // totals at avg_ns
+    unsigned long       avg[NR_PRESSURE_STATES][NR_PRESSURE_WINDOWS];
+};
+
+/* pressure snapshot, averages in hundredths of a percent */
+struct cacheobj_pressure_stat {
+    unsigned long       avg[NR_PRESSURE_STATES][NR_PRESSURE_WINDOWS];
+    u64                 total_us[NR_PRESSURE_STATES];
+};
+
+/*
+ * lock-free token bucket, refilled at rate tokens/sec up to a burst of one
+ * second worth of tokens. tokens may go negative for debt based limits.
+ */
+struct cacheobj_token_bucket {
+    u64                 rate; // 0 for unlimited
+    atomic64_t          tokens;
+    atomic64_t          last_ns; // time of last refill
+};
+
 #ifdef CONFIG_CACHEOBJS_CONNPOOL // new version
 struct cacheobj_connection_pool {
-    const char          *ip;
+    char                ip[INET_ADDRSTRLEN];
     unsigned int	    port;
     atomic_t            nr_connections;
     struct list_head    conn_list;
     struct semaphore    conn_sem;
+    spinlock_t          wait_lock; // protects wait_list
+    struct list_head    wait_list; // getters parked for a hand-off, oldest first
+    atomic_t            nr_waiters; // getters in the pool slow path
+    struct cacheobj_token_bucket ops_limit;   // gets per sec
+    struct cacheobj_token_bucket bytes_limit; // tx + rx bytes per sec
     struct hlist_node   hentry;
+    u32                 key; // bucket hash key
+    // per-cpu hint of the connection last handed out on that cpu
+    struct cacheobj_connection_node * __percpu *last_conn;
 #ifdef CONFIG_CACHEOBJS_STATS
+    ktime_t             last_release_ns;
     stat64_t            nr_slow_paths;
+    stat64_t            nr_affinity_hits;
+    stat64_t            nr_affinity_misses;
+    stat64_t            nr_handoffs;
+    stat64_t            nr_wakeups;
+    stat64_t            cum_wake_ns; // cum time from put to woken getter
+    stat64_t            nr_lease_expired;
+    stat64_t            nr_lease_recycled;
+    stat64_t            nr_stale_puts; // puts by holders whose lease was revoked
+    stat64_t            nr_hedges;     // hedged gets which also tried secondary
+    stat64_t            nr_hedge_wins; // ... and were served by secondary
+    stat64_t            nr_throttled_gets;
+    stat64_t            nr_throttled_bytes; // byte accountings over budget
+    stat64_t            nr_try_misses; // non-sleeping gets with none ready
+    struct cacheobj_op_stats op_stats[MAX_OP_TYPE]; // predefined classes
+    // registered classes, allocated on first use in the pool
+    struct cacheobj_op_stats *op_class_stats[MAX_OP_CLASSES - MAX_OP_TYPE];
+    struct cacheobj_pressure pressure;
+    struct cacheobjects_hist wait_hist; // wait time to grab ready conn (ns)
 #endif
 };
 
 struct cacheobj_connection_node {
-    const char          *ip;
+    char                ip[INET_ADDRSTRLEN];
     unsigned int        port;
+    unsigned int        flags;
     atomic_long_t	    state;
     unsigned int        nr_retry_attempts;
+    // holder pid, negated once the watchdog revoked its lease
+    atomic_t            holder_pid;
+    char                holder_comm[TASK_COMM_LEN];
+    unsigned long       lease;       // lease in jiffies, 0 for none
+    unsigned long       lease_start; // jiffies at get
 #ifdef CONFIG_CACHEOBJS_STATS
     ktime_t             now_ns;
     stat64_t		    cum_get_ns;  // cum time for GET
@@ -86,10 +192,15 @@ struct cacheobj_connection_node {
     stat64_t            nr_lookups;
     stat64_t		    tx_bytes;
     stat64_t		    rx_bytes;
+    u64                 slow_paths_at_get; // pool nr_slow_paths at get
 #endif
     struct list_head    list_node;
     struct cacheobj_connection_pool *pool;
 };
+
+/* node flags */
+#define CONN_NODE_TABLE_ALLOC (1U << 0) // from node_alloc, freed by table
+
 #else // older version
 struct cacheobj_connection_node {
     const char		    *ip;
@@ -108,6 +219,7 @@ struct cacheobj_connection_node {
     stat64_t		    rx_bytes;
 #endif
     struct hlist_node	hentry;	// hash node for quick lookup
+    void                *wait_var; // getters of the node sleep on, see insert
 };
 #endif
 
@@ -118,8 +230,109 @@ void cacheobj_connection_node_failed(struct cacheobj_connection_node *);
 void cacheobj_connection_node_retry(struct cacheobj_connection_node *);
 void cacheobj_connection_node_ready(struct cacheobj_connection_node *);
 
+#define MAX_REPLICAS 16
+
+/* group of ip:port pools, any of which can serve a request */
+struct cacheobj_replica_group {
+    struct list_head    list; // on table group list
+    unsigned int        nr_replicas;
+    struct {
+        char            ip[INET_ADDRSTRLEN];
+        unsigned int    port;
+    } replicas[MAX_REPLICAS];
+#ifdef CONFIG_CACHEOBJS_STATS
+    stat64_t            nr_gets;
+    stat64_t            nr_fallbacks; // gets served by other than first pick
+#endif
+};
+
+#define RING_VNODES_DEFAULT 160
+#define RING_INDEX_BITS 12
+
+/*
+ * consistent hash ring over table pools, immutable once published.
+ * points are sorted vnode hashes, owner maps a point to its node and
+ * index holds the first point of each top RING_INDEX_BITS hash range.
+ */
+struct cacheobj_hash_ring {
+    struct rcu_head     rcu;
+    unsigned int        nr_points;
+    unsigned int        nr_nodes;
+    u32                 index[(1 << RING_INDEX_BITS) + 1];
+    u32                 *points;
+    u32                 *owner;
+    struct {
+        char            ip[INET_ADDRSTRLEN];
+        unsigned int    port;
+    } *nodes;
+};
+
+/* instrumented locks */
+enum {
+    LOCK_TABLE_READ = 0,
+    LOCK_TABLE_WRITE,
+    LOCK_POOL_SEM, // pool semaphore sleeps of getters
+    NR_LOCK_STATS
+};
+
+/* per cpu lock accumulators, summed on dump */
+struct cacheobj_lock_stats {
+    struct {
+        u64             nr_acquired;
+        u64             nr_contended; // had to wait
+        u64             cum_wait_ns;
+        u64             cum_hold_ns;
+    } lock[NR_LOCK_STATS];
+};
+
+/* one in PROBE_SAMPLE_RATE bucket walks of lookups is sampled */
+#define PROBE_SAMPLE_RATE 64
+
+/* per cpu bucket walk accumulators, summed on dump */
+struct cacheobj_probe_stats {
+    unsigned long       nr_walks; // all walks, drives sampling
+    u64                 nr_sampled;
+    u64                 cum_probes; // entries compared by sampled walks
+    u64                 max_probes;
+};
+
+/* conntable flags, set by table owner before use */
+#define CONNTABLE_AFFINITY  (1UL << 0) // prefer connection last used on cpu
+#define CONNTABLE_HANDOFF   (1UL << 1) // put passes connection to oldest waiter
+#define CONNTABLE_LEASE_RECYCLE (1UL << 2) // watchdog reclaims leases of exited holders
+#define CONNTABLE_LEGACY_SLOWPATH (1UL << 3) // v1 getters sleep on first busy conn
+
+#define CONNTABLE_RESERVE_DEFAULT 64
+
 struct cacheobj_conntable {
     rwlock_t		lock; // lock for the entire table. (TBD : use rcu)
+    unsigned long   flags;
+    struct delayed_work watchdog; // lease expiry scan
+    unsigned long   watchdog_interval;
+    struct list_head groups; // replica groups, protected by lock
+    unsigned int    nr_pools; // protected by lock
+    unsigned int    ring_vnodes; // vnodes per pool, 0 for default
+    struct mutex    ring_lock; // serializes ring rebuilds
+    struct cacheobj_hash_ring __rcu *ring;
+    bool            ring_dirty; // pools added since, ring rebuilt on next use
+    // emergency reserve so inserts progress under memory pressure
+    unsigned int    reserve_nr; // per reserve, 0 for default
+    mempool_t       *node_reserve;
+    mempool_t       *pool_reserve;
+    unsigned int    nr_op_classes; // registered, protected by lock
+    char            op_classes[MAX_OP_CLASSES][OP_CLASS_NAME_LEN];
+#ifdef CONFIG_CACHEOBJS_STATS
+    stat64_t        nr_reserve_used;      // allocations served by reserve
+    stat64_t        nr_reserve_exhausted; // ... which had to wait for a free
+    struct cacheobj_lock_stats __percpu *lock_stats;
+    struct cacheobj_probe_stats __percpu *probe_stats;
+    struct cacheobj_pressure pressure; // over pools, a pool counts once
+    struct conntrace trace; // flight recorder
+    struct conntable_topk topk; // hottest pools
+#endif
+    u64             trace_threshold_ns; // set by owner, 0 for no auto dumps
+    u64             outlier_threshold_ns; // set by owner, 0 for no capture
+    struct conntable_hash hash; // fn set by owner, jhash by default
     DECLARE_HASHTABLE(buckets, MAX_BUCKET_BITS);
 };
 
@@ -127,6 +340,8 @@ struct cacheobj_conntable {
 struct cacheobj_conntable_operations {
     int (*cacheobj_conntable_init) (struct cacheobj_conntable *);
     int (*cacheobj_conntable_destroy) (struct cacheobj_conntable *);
+    // releases what init set up, once no op can run. NULL if nothing to free
+    void (*cacheobj_conntable_exit) (struct cacheobj_conntable *);
     int (*cacheobj_conntable_insert) (struct cacheobj_conntable *,
             struct cacheobj_connection_node *);
     int (*cacheobj_conntable_remove) (struct cacheobj_conntable *,
@@ -138,14 +353,156 @@ struct cacheobj_conntable_operations {
     struct cacheobj_connection_node* (*cacheobj_conntable_timed_get)
         (struct cacheobj_conntable *table, const char *ip,
          unsigned int port, long timeout);
+    struct cacheobj_connection_node* (*cacheobj_conntable_leased_get)
+        (struct cacheobj_conntable *table, const char *ip,
+         unsigned int port, long timeout, unsigned long lease);
     void (*cacheobj_conntable_put) (struct cacheobj_conntable *table,
-            struct cacheobj_connection_node *, conn_op_t);
+            struct cacheobj_connection_node *, conn_op_t op_class);
     void (*cacheobj_conntable_dump)
         (struct cacheobj_conntable *, struct seq_file *);
+    /* optional, NULL if backend does not support it */
+    int (*cacheobj_conntable_watchdog)
+        (struct cacheobj_conntable *, unsigned long interval);
+    struct cacheobj_replica_group* (*cacheobj_conntable_group_create)
+        (struct cacheobj_conntable *, const char **ip,
+         const unsigned int *port, unsigned int nr_replicas);
+    void (*cacheobj_conntable_group_destroy) (struct cacheobj_conntable *,
+            struct cacheobj_replica_group *);
+    struct cacheobj_connection_node* (*cacheobj_conntable_group_get)
+        (struct cacheobj_conntable *, struct cacheobj_replica_group *,
+         long timeout);
+    struct cacheobj_connection_node* (*cacheobj_conntable_key_get)
+        (struct cacheobj_conntable *, const void *key, size_t len,
+         long timeout);
+    struct cacheobj_connection_node* (*cacheobj_conntable_hedged_get)
+        (struct cacheobj_conntable *, const char *ip, unsigned int port,
+         const char *hedge_ip, unsigned int hedge_port, long timeout,
+         long hedge_after);
+    int (*cacheobj_conntable_account) (struct cacheobj_conntable *,
+            struct cacheobj_connection_node *, size_t tx, size_t rx);
+    int (*cacheobj_conntable_ratelimit) (struct cacheobj_conntable *,
+            const char *ip, unsigned int port, u64 ops_per_sec,
+            u64 bytes_per_sec);
+    struct cacheobj_connection_node* (*cacheobj_conntable_node_alloc)
+        (struct cacheobj_conntable *, const char *ip, unsigned int port);
+    void (*cacheobj_conntable_node_free) (struct cacheobj_conntable *,
+            struct cacheobj_connection_node *);
+    struct cacheobj_connection_node* (*cacheobj_conntable_try_get)
+        (struct cacheobj_conntable *, const char *ip, unsigned int port);
+    int (*cacheobj_conntable_op_register) (struct cacheobj_conntable *,
+            const char *name);
+    // pool pressure, or table pressure with NULL ip
+    int (*cacheobj_conntable_pressure) (struct cacheobj_conntable *,
+            const char *ip, unsigned int port,
+            struct cacheobj_pressure_stat *);
+    void (*cacheobj_conntable_pressure_dump) (struct cacheobj_conntable *,
+            struct seq_file *);
+    void (*cacheobj_conntable_trace_dump) (struct cacheobj_conntable *,
+            struct seq_file *);
+    void (*cacheobj_conntable_outlier_dump) (struct cacheobj_conntable *,
+            struct seq_file *);
+    void (*cacheobj_conntable_bucket_dump) (struct cacheobj_conntable *,
+            struct seq_file *);
+    void (*cacheobj_conntable_topk_dump) (struct cacheobj_conntable *,
+            struct seq_file *);
+    // pools and connections of a topology blob (conntable_topo.h)
+    int (*cacheobj_conntable_bulk_load) (struct cacheobj_conntable *,
+            const void *blob, size_t len);
+    // topology blob of the pools, with their counters, for bulk_load
+    void* (*cacheobj_conntable_snapshot) (struct cacheobj_conntable *,
+            size_t *len);
 };
 
 const extern struct cacheobj_conntable_operations cacheobj_conntable_ops;
 
+/*
+ * direct calls to the hot ops of the installed backend, patched at install
+ * so they skip the retpoline/ibt cost of calling through the ops table.
+ * callers must install a backend before using the conntable_call_* helpers.
+ */
+DECLARE_STATIC_CALL(conntable_lookup,
+    *cacheobj_conntable_ops.cacheobj_conntable_lookup);
+DECLARE_STATIC_CALL(conntable_timed_get,
+    *cacheobj_conntable_ops.cacheobj_conntable_timed_get);
+DECLARE_STATIC_CALL(conntable_leased_get,
+    *cacheobj_conntable_ops.cacheobj_conntable_leased_get);
+DECLARE_STATIC_CALL(conntable_put,
+    *cacheobj_conntable_ops.cacheobj_conntable_put);
+
+void cacheobj_conntable_ops_install
+    (const struct cacheobj_conntable_operations *ops);
+
+static inline struct cacheobj_connection_node *conntable_call_lookup
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port)
+{
+    return static_call(conntable_lookup)(table, ip, port);
+}
+
+static inline struct cacheobj_connection_node *conntable_call_timed_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+     long timeout)
+{
+    return static_call(conntable_timed_get)(table, ip, port, timeout);
+}
+
+static inline struct cacheobj_connection_node *conntable_call_leased_get
+    (struct cacheobj_conntable *table, const char *ip, unsigned int port,
+     long timeout, unsigned long lease)
+{
+    return static_call(conntable_leased_get)(table, ip, port, timeout, lease);
+}
+
+static inline void conntable_call_put(struct cacheobj_conntable *table,
+    struct cacheobj_connection_node *connp, conn_op_t op_class)
+{
+    static_call(conntable_put)(table, connp, op_class);
+}
+
+/* bucket report, conntable_buckets.c */
+int conntable_probe_stats_init(struct cacheobj_conntable *table);
+void conntable_probe_stats_exit(struct cacheobj_conntable *table);
+void conntable_bucket_report(struct cacheobj_conntable *table,
+    const unsigned int *chain, struct seq_file *m);
+
+/*
+ * entries chained on each of the MAX_BUCKETS buckets
+ * note: caller must have table read lock
+ */
+static inline void conntable_bucket_chains(struct cacheobj_conntable *table,
+    unsigned int *chain)
+{
+    unsigned int bkt;
+    struct hlist_node *pos;
+
+    for (bkt = 0; bkt < HASH_SIZE(table->buckets); bkt++) {
+        chain[bkt] = 0;
+        hlist_for_each(pos, &table->buckets[bkt])
+            chain[bkt]++;
+    }
+}
+
+/*
+ * account a bucket walk which compared probes entries, one in
+ * PROBE_SAMPLE_RATE walks of a cpu is sampled
+ */
+static inline void conntable_probe_record(struct cacheobj_conntable *table,
+    unsigned int probes)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    struct cacheobj_probe_stats *ps;
+
+    if (!table->probe_stats || (this_cpu_inc_return(
+            table->probe_stats->nr_walks) % PROBE_SAMPLE_RATE))
+        return;
+    ps = get_cpu_ptr(table->probe_stats);
+    ps->nr_sampled++;
+    ps->cum_probes += probes;
+    if (probes > ps->max_probes)
+        ps->max_probes = probes;
+    put_cpu_ptr(table->probe_stats);
+#endif
+}
+
 #define CONNTBL_ASSERT(X)                                               \
     do {                                                                    \
         if (unlikely(!(X))) {                                           \
@@ -0,0 +1,92 @@
+/* Connection table bucket statistics
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+#include "conntable.h"
+
+/* chain lengths counted apart in the histogram, longer ones share a slot */
+#define CHAIN_HIST_MAX 8
+
+int conntable_probe_stats_init(struct cacheobj_conntable *table)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    table->probe_stats = alloc_percpu(struct cacheobj_probe_stats);
+    if (!table->probe_stats)
+        return -ENOMEM;
+#endif
+    return 0;
+}
+
+void conntable_probe_stats_exit(struct cacheobj_conntable *table)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    free_percpu(table->probe_stats);
+    table->probe_stats = NULL;
+#endif
+}
+
+static void __conntable_probe_report(struct cacheobj_conntable *table,
+    struct seq_file *m)
+{
+#ifdef CONFIG_CACHEOBJS_STATS
+    int cpu;
+    u64 walks = 0, sampled = 0, probes = 0, max = 0;
+    struct cacheobj_probe_stats *ps;
+
+    if (!table->probe_stats)
+        return;
+
+    for_each_possible_cpu(cpu) {
+        ps = per_cpu_ptr(table->probe_stats, cpu);
+        walks += READ_ONCE(ps->nr_walks);
+        sampled += READ_ONCE(ps->nr_sampled);
+        probes += READ_ONCE(ps->cum_probes);
+        max = max_t(u64, max, READ_ONCE(ps->max_probes));
+    }
+    seq_printf(m, "lookups :%llu sampled :%llu avg_probes(x100) :%lu "
+            "max_probes :%llu\n", walks, sampled,
+            div64_safe(probes * 100, sampled), max);
+#endif
+}
+
+/*
+ * chain length of each bucket, histogram of chain lengths, load factor and
+ * probes per lookup sampled on the live path. chain is filled by the
+ * backend under its table lock (conntable_bucket_chains), an entry is a
+ * pool (v2) or a connection (v1).
+ */
+void conntable_bucket_report(struct cacheobj_conntable *table,
+    const unsigned int *chain, struct seq_file *m)
+{
+    unsigned int bkt, entries = 0, empty = 0, max = 0;
+    unsigned int hist[CHAIN_HIST_MAX + 1] = { 0 };
+
+    for (bkt = 0; bkt < MAX_BUCKETS; bkt++) {
+        entries += chain[bkt];
+        max = max(max, chain[bkt]);
+        if (!chain[bkt])
+            empty++;
+        hist[min_t(unsigned int, chain[bkt], CHAIN_HIST_MAX)]++;
+    }
+
+    seq_printf(m, "buckets :%u entries :%u load_factor :%u.%02u empty :%u "
+            "max_chain :%u\n", MAX_BUCKETS, entries, entries / MAX_BUCKETS,
+            (entries % MAX_BUCKETS) * 100 / MAX_BUCKETS, empty, max);
+    __conntable_probe_report(table, m);
+
+    seq_puts(m, "\nCHAIN\tBUCKETS\n");
+    for (bkt = 0; bkt < CHAIN_HIST_MAX; bkt++)
+        seq_printf(m, "%u\t%u\n", bkt, hist[bkt]);
+    seq_printf(m, "%u+\t%u\n", CHAIN_HIST_MAX, hist[CHAIN_HIST_MAX]);
+
+    seq_puts(m, "\nBUCKET\tCHAIN\n");
+    for (bkt = 0; bkt < MAX_BUCKETS; bkt++)
+        seq_printf(m, "%u\t%u\n", bkt, chain[bkt]);
+}
@@ -0,0 +1,34 @@
+/* Connection table backend dispatch
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/static_call.h>
+
+#include "conntable.h"
+
+DEFINE_STATIC_CALL_NULL(conntable_lookup,
+    *cacheobj_conntable_ops.cacheobj_conntable_lookup);
+DEFINE_STATIC_CALL_NULL(conntable_timed_get,
+    *cacheobj_conntable_ops.cacheobj_conntable_timed_get);
+DEFINE_STATIC_CALL_NULL(conntable_leased_get,
+    *cacheobj_conntable_ops.cacheobj_conntable_leased_get);
+DEFINE_STATIC_CALL_NULL(conntable_put,
+    *cacheobj_conntable_ops.cacheobj_conntable_put);
+
+/*
+ * point the direct calls at ops, may be called again to switch backends
+ * once no caller is inside the old one
+ */
+void cacheobj_conntable_ops_install
+    (const struct cacheobj_conntable_operations *ops)
+{
+    static_call_update(conntable_lookup, ops->cacheobj_conntable_lookup);
+    static_call_update(conntable_timed_get, ops->cacheobj_conntable_timed_get);
+    static_call_update(conntable_leased_get,
+        ops->cacheobj_conntable_leased_get);
+    static_call_update(conntable_put, ops->cacheobj_conntable_put);
+}
@@ -0,0 +1,90 @@
+/* Connection table key hashes
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#ifndef __CONNTABLE_HASH_H
+#define __CONNTABLE_HASH_H
+
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/random.h>
+#include <linux/jhash.h>
+#include <linux/siphash.h>
+#include <linux/hash.h>
+
+/*
+ * hash of an (address, port) key:
+ * -jhash    : Ref https://www.kfki.hu/~kadlec/sw/netfilter/ct3/, default
+ * -hsiphash : keyed, keys cannot be chosen to collide
+ * -mult     : golden ratio multiply of the seeded 64 bit key, cheapest,
+ *             weakest on clustered keys
+ */
+typedef enum conntable_hash_fn {
+    CONNTABLE_HASH_JHASH = 0,
+    CONNTABLE_HASH_HSIPHASH,
+    CONNTABLE_HASH_MULT,
+    NR_CONNTABLE_HASHES
+}conntable_hash_fn_t;
+
+/* hash of a table, fn set by owner before init, seeds by init */
+struct conntable_hash {
+    conntable_hash_fn_t fn;
+    u32                 seed; // jhash
+    u64                 mult_seed;
+    hsiphash_key_t      key; // hsiphash
+};
+
+static inline const char *conntable_hash_name(conntable_hash_fn_t fn)
+{
+    switch (fn) {
+    case CONNTABLE_HASH_JHASH:
+        return "jhash";
+    case CONNTABLE_HASH_HSIPHASH:
+        return "hsiphash";
+    case CONNTABLE_HASH_MULT:
+        return "mult";
+    default:
+        return "unknown";
+    }
+}
+
+/* hash fn given its name, -EINVAL if none */
+static inline int conntable_hash_parse(const char *name)
+{
+    int fn;
+
+    for (fn = 0; fn < NR_CONNTABLE_HASHES; fn++) {
+        if (sysfs_streq(name, conntable_hash_name(fn)))
+            return fn;
+    }
+    return -EINVAL;
+}
+
+static inline int conntable_hash_seed(struct conntable_hash *h)
+{
+    if (h->fn >= NR_CONNTABLE_HASHES)
+        return -EINVAL;
+    get_random_bytes(&h->seed, sizeof(h->seed));
+    get_random_bytes(&h->mult_seed, sizeof(h->mult_seed));
+    get_random_bytes(&h->key, sizeof(h->key));
+    return 0;
+}
+
+static inline u32 conntable_hash_2words(const struct conntable_hash *h,
+    u32 daddr, u32 port)
+{
+    switch (h->fn) {
+    case CONNTABLE_HASH_HSIPHASH:
+        return hsiphash_2u32(daddr, port, &h->key);
+    case CONNTABLE_HASH_MULT:
+        return hash_64((((u64)daddr << 32) | port) ^ h->mult_seed, 32);
+    default:
+        return jhash_2words(daddr, port, h->seed);
+    }
+}
+
+#endif
@@ -0,0 +1,733 @@
+/* Connection table KUnit tests and micro benchmarks
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ *
+ * covers the table ops of the backend built in (CONNTABLE_BACKEND), see
+ * README.md for running under uml with kunit.py
+ */
+#include <kunit/test.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/timex.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
+
+#include "conntable.h"
+#include "stat.h"
+
+#define KTEST_IP "127.0.0.1"
+
+/* micro benchmark sizes, small enough for uml */
+#define KTEST_BENCH_NODES 1024
+#define KTEST_BENCH_LOOPS 100000
+#define KTEST_BENCH_ROUNDS 4 // of each dispatch, get/put benchmark
+
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+#define KTEST_SUITE "conntable_connpool"
+#else
+#define KTEST_SUITE "conntable_connhash"
+#endif
+
+static const struct cacheobj_conntable_operations *conn_ops =
+    &cacheobj_conntable_ops;
+
+static inline unsigned long _conn_state(struct cacheobj_connection_node *conn)
+{
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+    return atomic_long_read(&conn->state);
+#else
+    return conn->state;
+#endif
+}
+
+/* node freed by kunit after the test, table must have let go of it */
+static struct cacheobj_connection_node *_alloc_node(struct kunit *test,
+    unsigned int port)
+{
+    struct cacheobj_connection_node *conn;
+
+    conn = kunit_kzalloc(test, sizeof(*conn), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, conn);
+    KUNIT_ASSERT_EQ(test, cacheobj_connection_node_init(conn, KTEST_IP, port),
+        0);
+    return conn;
+}
+
+static struct cacheobj_connection_node *_insert_node(struct kunit *test,
+    unsigned int port)
+{
+    struct cacheobj_connection_node *conn = _alloc_node(test, port);
+
+    KUNIT_ASSERT_EQ(test, conn_ops->cacheobj_conntable_insert(test->priv,
+        conn), 0);
+    return conn;
+}
+
+static int conntable_test_init(struct kunit *test)
+{
+    int err;
+    struct cacheobj_conntable *table;
+
+    table = kunit_kzalloc(test, sizeof(*table), GFP_KERNEL);
+    if (!table)
+        return -ENOMEM;
+    err = conn_ops->cacheobj_conntable_init(table);
+    if (err)
+        return err;
+    cacheobj_conntable_ops_install(conn_ops);
+    test->priv = table;
+    return 0;
+}
+
+/* destroy, then release, a table of conntable_test_init */
+static void _exit_table(struct kunit *test, struct cacheobj_conntable *table)
+{
+    KUNIT_EXPECT_EQ(test, conn_ops->cacheobj_conntable_destroy(table), 0);
+    if (conn_ops->cacheobj_conntable_exit)
+        conn_ops->cacheobj_conntable_exit(table);
+}
+
+static void conntable_test_exit(struct kunit *test)
+{
+    _exit_table(test, test->priv);
+}
+
+static void conntable_test_empty(struct kunit *test)
+{
+    KUNIT_EXPECT_NULL(test, conn_ops->cacheobj_conntable_lookup(test->priv,
+        KTEST_IP, 1));
+    KUNIT_EXPECT_NULL(test, conn_ops->cacheobj_conntable_timed_get(
+        test->priv, KTEST_IP, 1, HZ));
+}
+
+static void conntable_test_insert_lookup(struct kunit *test)
+{
+    struct cacheobj_connection_node *conn = _insert_node(test, 1);
+
+    KUNIT_EXPECT_EQ(test, _conn_state(conn), (unsigned long)CONN_READY);
+    KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_lookup(
+        test->priv, KTEST_IP, 1), conn);
+    KUNIT_EXPECT_NULL(test, conn_ops->cacheobj_conntable_lookup(test->priv,
+        KTEST_IP, 2));
+    KUNIT_EXPECT_TRUE(test, IS_ERR(conn_ops->cacheobj_conntable_lookup(
+        test->priv, "not.an.ip", 1)));
+}
+
+/* ready -> active on get, back to ready on put */
+static void conntable_test_get_put(struct kunit *test)
+{
+    struct cacheobj_connection_node *conn = _insert_node(test, 1), *got;
+
+    got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1, HZ);
+    KUNIT_ASSERT_PTR_EQ(test, got, conn);
+    KUNIT_EXPECT_EQ(test, _conn_state(conn), (unsigned long)CONN_ACTIVE);
+
+    conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+    KUNIT_EXPECT_EQ(test, _conn_state(conn), (unsigned long)CONN_READY);
+}
+
+/* every connection of the node gets handed out once */
+static void conntable_test_get_all(struct kunit *test)
+{
+    unsigned int i;
+    struct cacheobj_connection_node *got[4];
+
+    for (i = 0; i < ARRAY_SIZE(got); i++)
+        _insert_node(test, 1);
+
+    for (i = 0; i < ARRAY_SIZE(got); i++) {
+        got[i] = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP,
+            1, HZ);
+        KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got[i]);
+        if (i)
+            KUNIT_EXPECT_PTR_NE(test, got[i], got[i - 1]);
+    }
+    for (i = 0; i < ARRAY_SIZE(got); i++)
+        conn_ops->cacheobj_conntable_put(test->priv, got[i], GET);
+}
+
+/* get times out while the only connection is held */
+static void conntable_test_get_timeout(struct kunit *test)
+{
+    struct cacheobj_connection_node *got;
+
+    _insert_node(test, 1);
+    got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1, HZ);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+
+    KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_timed_get(
+        test->priv, KTEST_IP, 1, 1), ERR_PTR(-ETIME));
+    if (conn_ops->cacheobj_conntable_try_get)
+        KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_try_get(
+            test->priv, KTEST_IP, 1), ERR_PTR(-EAGAIN));
+
+    conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+    got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1, 1);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+    conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+}
+
+/* getter parked on a node, puts what it got once released */
+struct ktest_getter {
+    struct cacheobj_conntable *table;
+    struct cacheobj_connection_node *got;
+    struct completion got_done;
+    struct completion release;
+    struct completion exited;
+};
+
+static int _getter_fn(void *data)
+{
+    struct ktest_getter *g = data;
+
+    g->got = conn_ops->cacheobj_conntable_timed_get(g->table, KTEST_IP, 1,
+        5 * HZ);
+    complete(&g->got_done);
+    wait_for_completion(&g->release);
+    if (!IS_ERR_OR_NULL(g->got))
+        conn_ops->cacheobj_conntable_put(g->table, g->got, GET);
+    complete(&g->exited);
+    return 0;
+}
+
+/*
+ * a waiting getter takes whichever connection of the node is put first,
+ * not the one it found busy first (the newest, at the bucket head)
+ */
+static void conntable_test_get_wait_any(struct kunit *test)
+{
+    unsigned long done;
+    struct task_struct *task;
+    struct cacheobj_connection_node *got[2];
+    struct ktest_getter g = { .table = test->priv };
+
+    _insert_node(test, 1);
+    _insert_node(test, 1);
+    got[0] = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1,
+        HZ);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got[0]);
+    got[1] = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1,
+        HZ);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got[1]);
+
+    init_completion(&g.got_done);
+    init_completion(&g.release);
+    init_completion(&g.exited);
+    task = kthread_run(_getter_fn, &g, "conntable_getter");
+    KUNIT_ASSERT_FALSE(test, IS_ERR(task));
+
+    msleep(20); // let the getter park
+    conn_ops->cacheobj_conntable_put(test->priv, got[1], GET);
+    done = wait_for_completion_timeout(&g.got_done, 2 * HZ);
+    KUNIT_EXPECT_NE(test, done, 0UL);
+    conn_ops->cacheobj_conntable_put(test->priv, got[0], GET);
+    if (!done)
+        wait_for_completion(&g.got_done);
+    KUNIT_EXPECT_PTR_EQ(test, g.got, got[1]);
+
+    complete(&g.release);
+    wait_for_completion(&g.exited);
+}
+
+/* active connections cannot be removed */
+static void conntable_test_remove(struct kunit *test)
+{
+    struct cacheobj_connection_node *conn = _insert_node(test, 1), *got;
+
+    got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1, HZ);
+    KUNIT_ASSERT_PTR_EQ(test, got, conn);
+    KUNIT_EXPECT_EQ(test, conn_ops->cacheobj_conntable_remove(test->priv,
+        conn), -EBUSY);
+    conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+
+    KUNIT_ASSERT_EQ(test, conn_ops->cacheobj_conntable_remove(test->priv,
+        conn), 0);
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+    KUNIT_EXPECT_EQ(test, _conn_state(conn), (unsigned long)CONN_ZOMBIE);
+#endif
+    KUNIT_EXPECT_NULL(test, conn_ops->cacheobj_conntable_lookup(test->priv,
+        KTEST_IP, 1));
+    cacheobj_connection_node_destroy(conn);
+}
+
+/* getter looping on a node until stopped, counting gets that went wrong */
+struct ktest_churn {
+    struct cacheobj_conntable *table;
+    unsigned long nr_gets;
+    unsigned long nr_errors;
+};
+
+static int _churn_getter_fn(void *data)
+{
+    struct ktest_churn *c = data;
+    struct cacheobj_connection_node *got;
+
+    while (!kthread_should_stop()) {
+        got = conn_ops->cacheobj_conntable_timed_get(c->table, KTEST_IP, 1,
+            HZ / 10);
+        if (IS_ERR_OR_NULL(got)) {
+            if (PTR_ERR(got) != -ETIME)
+                c->nr_errors++;
+        } else {
+            c->nr_gets++;
+            conn_ops->cacheobj_conntable_put(c->table, got, GET);
+        }
+        cond_resched();
+    }
+    return 0;
+}
+
+/* connections of a node are removed while getters keep taking them */
+static void conntable_test_remove_race(struct kunit *test)
+{
+    unsigned int i, tries;
+    int err;
+    struct task_struct *task[2];
+    struct cacheobj_connection_node *conn[8];
+    struct ktest_churn c[ARRAY_SIZE(task)];
+
+    for (i = 0; i < ARRAY_SIZE(conn); i++)
+        conn[i] = _insert_node(test, 1);
+
+    for (i = 0; i < ARRAY_SIZE(task); i++) {
+        c[i] = (struct ktest_churn){ .table = test->priv };
+        task[i] = kthread_run(_churn_getter_fn, &c[i], "conntable_churn");
+        KUNIT_ASSERT_FALSE(test, IS_ERR(task[i]));
+    }
+
+    // the last connection stays, so a get always has one to wait for
+    for (i = 0; i < ARRAY_SIZE(conn) - 1; i++) {
+        for (tries = 0; tries < 10000; tries++) {
+            err = conn_ops->cacheobj_conntable_remove(test->priv, conn[i]);
+            if (err != -EBUSY && err != -EAGAIN)
+                break;
+            usleep_range(10, 50);
+        }
+        KUNIT_EXPECT_EQ(test, err, 0);
+        if (!err)
+            cacheobj_connection_node_destroy(conn[i]);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(task); i++) {
+        kthread_stop(task[i]);
+        KUNIT_EXPECT_EQ(test, c[i].nr_errors, 0UL);
+        KUNIT_EXPECT_NE(test, c[i].nr_gets, 0UL);
+    }
+    KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_lookup(
+        test->priv, KTEST_IP, 1), conn[ARRAY_SIZE(conn) - 1]);
+}
+
+/* destroy leaves held connections in the table */
+static void conntable_test_destroy_busy(struct kunit *test)
+{
+    struct cacheobj_connection_node *got;
+
+    _insert_node(test, 1);
+    got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP, 1, HZ);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+    KUNIT_EXPECT_NE(test, conn_ops->cacheobj_conntable_destroy(test->priv), 0);
+    KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_lookup(
+        test->priv, KTEST_IP, 1), got);
+    conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+}
+
+/* the pool got most often leads the gets of the heavy hitters */
+static void conntable_test_topk(struct kunit *test)
+{
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+    unsigned int i, port, hot = 0;
+    u64 best = 0;
+    struct conntable_topk_entry *top;
+    struct cacheobj_connection_node *got;
+
+    for (port = 1; port <= 4; port++)
+        _insert_node(test, port);
+
+    // 9 in 10 gets on port 1, the rest spread over 2 to 4
+    for (i = 0; i < 100 * TOPK_SAMPLE_RATE; i++) {
+        port = (i % 10) ? 1 : 2 + (i / 10) % 3;
+        got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP,
+            port, HZ);
+        KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+        conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+    }
+
+    top = ((struct cacheobj_conntable *)test->priv)->topk.top[TOPK_GETS];
+    for (i = 0; i < TOPK_NR; i++) {
+        if (top[i].count > best) {
+            best = top[i].count;
+            hot = top[i].port;
+        }
+    }
+    KUNIT_EXPECT_EQ(test, hot, 1U);
+#else
+    kunit_skip(test, "v1 keeps no pools");
+#endif
+}
+
+/* topology blob of nr nodes on KTEST_IP, ports 1 on, conns each */
+static void *_topo_blob(struct kunit *test, unsigned int nr,
+    unsigned int conns, size_t *len)
+{
+    unsigned int i;
+    struct conntable_topo_hdr *hdr;
+    struct conntable_topo_node *node;
+
+    *len = sizeof(*hdr) + nr * sizeof(*node);
+    hdr = kunit_kzalloc(test, *len, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, hdr);
+    hdr->magic = cpu_to_le32(CONNTABLE_TOPO_MAGIC);
+    hdr->version = cpu_to_le16(CONNTABLE_TOPO_VERSION);
+    hdr->hdr_len = cpu_to_le16(sizeof(*hdr));
+    hdr->nr_nodes = cpu_to_le32(nr);
+    hdr->node_len = cpu_to_le32(sizeof(*node));
+    node = (struct conntable_topo_node *)(hdr + 1);
+    for (i = 0; i < nr; i++) {
+        node[i].addr = htonl(0x7f000001);
+        node[i].port = cpu_to_le16(i + 1);
+        node[i].nr_conns = cpu_to_le32(conns);
+    }
+    return hdr;
+}
+
+/* loaded pools serve gets, a pool already in the table takes the extras */
+static void conntable_test_bulk_load(struct kunit *test)
+{
+    size_t len;
+    void *blob;
+    unsigned int port, i, nr;
+    struct cacheobj_connection_node *got[3];
+
+    if (!conn_ops->cacheobj_conntable_bulk_load)
+        kunit_skip(test, "backend has no bulk load");
+
+    _insert_node(test, 1);
+    blob = _topo_blob(test, 4, 2, &len);
+    KUNIT_EXPECT_EQ(test, conn_ops->cacheobj_conntable_bulk_load(test->priv,
+        blob, len - 1), -EINVAL);
+    KUNIT_ASSERT_EQ(test, conn_ops->cacheobj_conntable_bulk_load(test->priv,
+        blob, len), 0);
+
+    for (port = 1; port <= 4; port++) {
+        nr = (port == 1) ? 3 : 2;
+        for (i = 0; i < nr; i++) {
+            got[i] = conn_ops->cacheobj_conntable_timed_get(test->priv,
+                KTEST_IP, port, HZ);
+            KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got[i]);
+        }
+        KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_timed_get(
+            test->priv, KTEST_IP, port, 1), ERR_PTR(-ETIME));
+        for (i = 0; i < nr; i++)
+            conn_ops->cacheobj_conntable_put(test->priv, got[i], GET);
+    }
+}
+
+#if defined(CONFIG_CACHEOBJS_CONNPOOL) && defined(CONFIG_CACHEOBJS_STATS)
+static u64 _pool_stat_sum(struct cacheobj_connection_node *conn,
+    conntable_topo_stat_t stat)
+{
+    u64 sum = 0;
+    struct cacheobj_connection_node *connp;
+
+    list_for_each_entry(connp, &conn->pool->conn_list, list_node)
+        sum += cacheobjects_stat64_read((stat == TOPO_STAT_LOOKUPS) ?
+            &connp->nr_lookups : &connp->tx_bytes);
+    return sum;
+}
+#endif
+
+/* a snapshot restores pools sized as they were, and their counters */
+static void conntable_test_snapshot(struct kunit *test)
+{
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+    size_t len;
+    void *blob;
+    unsigned int i;
+    u64 lookups = 0, tx = 0;
+    struct cacheobj_conntable *table;
+    struct cacheobj_connection_node *got[3];
+
+    _insert_node(test, 1);
+    _insert_node(test, 1);
+    _insert_node(test, 2);
+    for (i = 0; i < 5; i++) {
+        got[0] = conn_ops->cacheobj_conntable_timed_get(test->priv,
+            KTEST_IP, 1, HZ);
+        KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got[0]);
+        conn_ops->cacheobj_conntable_account(test->priv, got[0], 100, 0);
+        conn_ops->cacheobj_conntable_put(test->priv, got[0], GET);
+    }
+#ifdef CONFIG_CACHEOBJS_STATS
+    lookups = _pool_stat_sum(got[0], TOPO_STAT_LOOKUPS);
+    tx = _pool_stat_sum(got[0], TOPO_STAT_TX_BYTES);
+#endif
+
+    blob = conn_ops->cacheobj_conntable_snapshot(test->priv, &len);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, blob);
+    KUNIT_EXPECT_EQ(test, conntable_topo_check(blob, len), 0);
+    KUNIT_EXPECT_EQ(test, conntable_topo_nr_nodes(blob), 2U);
+
+    // restore into a fresh table, as the next load would
+    table = kunit_kzalloc(test, sizeof(*table), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, table);
+    KUNIT_ASSERT_EQ(test, conn_ops->cacheobj_conntable_init(table), 0);
+    KUNIT_EXPECT_EQ(test, conn_ops->cacheobj_conntable_bulk_load(table, blob,
+        len), 0);
+    kvfree(blob);
+
+    for (i = 0; i < 2; i++) {
+        got[i] = conn_ops->cacheobj_conntable_timed_get(table, KTEST_IP, 1,
+            HZ);
+        KUNIT_EXPECT_NOT_ERR_OR_NULL(test, got[i]);
+    }
+    KUNIT_EXPECT_PTR_EQ(test, conn_ops->cacheobj_conntable_timed_get(table,
+        KTEST_IP, 1, 1), ERR_PTR(-ETIME));
+#ifdef CONFIG_CACHEOBJS_STATS
+    if (!IS_ERR_OR_NULL(got[0])) {
+        KUNIT_EXPECT_EQ(test, _pool_stat_sum(got[0], TOPO_STAT_LOOKUPS),
+            lookups + 2);
+        KUNIT_EXPECT_EQ(test, _pool_stat_sum(got[0], TOPO_STAT_TX_BYTES), tx);
+    }
+#endif
+    for (i = 0; i < 2; i++) {
+        if (!IS_ERR_OR_NULL(got[i]))
+            conn_ops->cacheobj_conntable_put(table, got[i], GET);
+    }
+    _exit_table(test, table);
+#else
+    kunit_skip(test, "v1 keeps no pools");
+#endif
+}
+
+static void conntable_bench_insert(struct kunit *test)
+{
+    unsigned int i;
+    ktime_t start;
+    struct cacheobj_connection_node **conn;
+
+    conn = kunit_kzalloc(test, sizeof(*conn) * KTEST_BENCH_NODES, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, conn);
+    for (i = 0; i < KTEST_BENCH_NODES; i++)
+        conn[i] = _alloc_node(test, i + 1);
+
+    start = ktime_get();
+    for (i = 0; i < KTEST_BENCH_NODES; i++)
+        conn_ops->cacheobj_conntable_insert(test->priv, conn[i]);
+    kunit_info(test, "insert %u nodes avg(ns) :%lu\n", KTEST_BENCH_NODES,
+        div64_safe(ktime_ns_delta(ktime_get(), start), KTEST_BENCH_NODES));
+}
+
+static void conntable_bench_lookup(struct kunit *test)
+{
+    unsigned int i;
+    ktime_t start;
+
+    for (i = 0; i < KTEST_BENCH_NODES; i++)
+        _insert_node(test, i + 1);
+
+    start = ktime_get();
+    for (i = 0; i < KTEST_BENCH_LOOPS; i++)
+        conn_ops->cacheobj_conntable_lookup(test->priv, KTEST_IP,
+            (i % KTEST_BENCH_NODES) + 1);
+    kunit_info(test, "lookup over %u nodes avg(ns) :%lu\n",
+        KTEST_BENCH_NODES, div64_safe(ktime_ns_delta(ktime_get(), start),
+        KTEST_BENCH_LOOPS));
+}
+
+/* get/put through the ops table or static calls, ns per pair */
+static unsigned long _bench_get_put(struct kunit *test, bool direct)
+{
+    unsigned int i, port;
+    ktime_t start;
+    struct cacheobj_connection_node *got;
+
+    start = ktime_get();
+    for (i = 0; i < KTEST_BENCH_LOOPS; i++) {
+        port = (i % KTEST_BENCH_NODES) + 1;
+        if (direct) {
+            got = conntable_call_timed_get(test->priv, KTEST_IP, port, HZ);
+            KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+            conntable_call_put(test->priv, got, GET);
+        } else {
+            got = conn_ops->cacheobj_conntable_timed_get(test->priv, KTEST_IP,
+                port, HZ);
+            KUNIT_ASSERT_NOT_ERR_OR_NULL(test, got);
+            conn_ops->cacheobj_conntable_put(test->priv, got, GET);
+        }
+    }
+    return div64_safe(ktime_ns_delta(ktime_get(), start), KTEST_BENCH_LOOPS);
+}
+
+/*
+ * after a warm up run, rounds alternate which dispatch runs first, so
+ * neither gains from caches the other warmed. best and mean of the rounds.
+ */
+static void conntable_bench_get_put(struct kunit *test)
+{
+    unsigned int i, r;
+    bool direct;
+    unsigned long ns, best[2] = { ULONG_MAX, ULONG_MAX }, sum[2] = { 0 };
+
+    for (i = 0; i < KTEST_BENCH_NODES; i++)
+        _insert_node(test, i + 1);
+
+    _bench_get_put(test, false);
+    for (r = 0; r < 2 * KTEST_BENCH_ROUNDS; r++) {
+        // ops table, static call, static call, ops table, ...
+        direct = (r & 1) ^ ((r >> 1) & 1);
+        ns = _bench_get_put(test, direct);
+        best[direct] = min(best[direct], ns);
+        sum[direct] += ns;
+    }
+
+    kunit_info(test, "get/put over %u nodes, %u rounds avg(ns) ops table "
+        ":%lu (best %lu) static call :%lu (best %lu)\n", KTEST_BENCH_NODES,
+        KTEST_BENCH_ROUNDS, sum[0] / KTEST_BENCH_ROUNDS, best[0],
+        sum[1] / KTEST_BENCH_ROUNDS, best[1]);
+}
+
+/* address sets of the hash benchmark */
+enum {
+    KTEST_KEYS_SEQ_PORT = 0, // one address, sequential ports
+    KTEST_KEYS_SUBNET, // sequential addresses of a subnet, one port
+    KTEST_KEYS_RANDOM,
+    NR_KTEST_KEYS
+};
+
+static u32 ktest_hash_sink;
+
+static void _hash_keys(int set, unsigned int i, u32 *daddr, u32 *port)
+{
+    switch (set) {
+    case KTEST_KEYS_SEQ_PORT:
+        *daddr = (__force u32) htonl(0x7f000001);
+        *port = i + 1;
+        break;
+    case KTEST_KEYS_SUBNET:
+        *daddr = (__force u32) htonl(0x0a000000 + i + 1);
+        *port = 11211;
+        break;
+    default:
+        *daddr = get_random_u32();
+        *port = get_random_u32() & 0xffff;
+        break;
+    }
+}
+
+/*
+ * chi square of keys over 1 << bits buckets, the table's (hash_min) or the
+ * low key bits, near (1 << bits) - 1 when uniform
+ */
+static unsigned long _hash_chi2(struct kunit *test, const u32 *keys,
+    unsigned int bits, bool low_bits, unsigned int *max)
+{
+    unsigned int i, nr = 1U << bits, *chain;
+    u64 sq = 0;
+
+    chain = kunit_kzalloc(test, sizeof(*chain) * nr, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, chain);
+    for (i = 0; i < KTEST_BENCH_NODES; i++)
+        chain[low_bits ? (keys[i] & (nr - 1)) : hash_min(keys[i], bits)]++;
+    *max = 0;
+    for (i = 0; i < nr; i++) {
+        sq += (u64)chain[i] * chain[i];
+        *max = max(*max, chain[i]);
+    }
+    kunit_kfree(test, chain);
+    return div64_safe(sq * nr, KTEST_BENCH_NODES) - KTEST_BENCH_NODES;
+}
+
+/*
+ * cycles and ns per key hash, and distribution of KTEST_BENCH_NODES keys
+ * over the table buckets and over the low key bits, for each hash on
+ * clustered and random address sets
+ */
+static void conntable_bench_hash(struct kunit *test)
+{
+    static const char * const set_names[NR_KTEST_KEYS] = {
+        [KTEST_KEYS_SEQ_PORT] = "seq_port",
+        [KTEST_KEYS_SUBNET] = "subnet",
+        [KTEST_KEYS_RANDOM] = "random",
+    };
+    int fn, set;
+    unsigned int i, bmax, lmax;
+    unsigned long bchi2, lchi2;
+    u32 *daddr, *port, *keys, sum = 0;
+    cycles_t cycles;
+    ktime_t start;
+    u64 ns;
+    struct conntable_hash h;
+
+    daddr = kunit_kzalloc(test, sizeof(u32) * KTEST_BENCH_NODES, GFP_KERNEL);
+    port = kunit_kzalloc(test, sizeof(u32) * KTEST_BENCH_NODES, GFP_KERNEL);
+    keys = kunit_kzalloc(test, sizeof(u32) * KTEST_BENCH_NODES, GFP_KERNEL);
+    KUNIT_ASSERT_TRUE(test, daddr && port && keys);
+
+    for (set = 0; set < NR_KTEST_KEYS; set++) {
+        for (i = 0; i < KTEST_BENCH_NODES; i++)
+            _hash_keys(set, i, &daddr[i], &port[i]);
+
+        for (fn = 0; fn < NR_CONNTABLE_HASHES; fn++) {
+            h.fn = fn;
+            KUNIT_ASSERT_EQ(test, conntable_hash_seed(&h), 0);
+
+            start = ktime_get();
+            cycles = get_cycles();
+            for (i = 0; i < KTEST_BENCH_LOOPS; i++)
+                sum += conntable_hash_2words(&h,
+                    daddr[i % KTEST_BENCH_NODES], port[i % KTEST_BENCH_NODES]);
+            cycles = get_cycles() - cycles;
+            ns = ktime_ns_delta(ktime_get(), start);
+            WRITE_ONCE(ktest_hash_sink, sum);
+
+            for (i = 0; i < KTEST_BENCH_NODES; i++)
+                keys[i] = conntable_hash_2words(&h, daddr[i], port[i]);
+            bchi2 = _hash_chi2(test, keys, MAX_BUCKET_BITS, false, &bmax);
+            lchi2 = _hash_chi2(test, keys, ilog2(KTEST_BENCH_NODES), true,
+                &lmax);
+
+            kunit_info(test, "%s %s cycles :%lu ns(x100) :%lu buckets %u "
+                "chi2 :%lu max :%u low bits %u chi2 :%lu max :%u\n",
+                conntable_hash_name(fn), set_names[set],
+                div64_safe(cycles, KTEST_BENCH_LOOPS),
+                div64_safe(ns * 100, KTEST_BENCH_LOOPS), MAX_BUCKETS, bchi2, bmax,
+                KTEST_BENCH_NODES, lchi2, lmax);
+        }
+    }
+}
+
+static struct kunit_case conntable_test_cases[] = {
+    KUNIT_CASE(conntable_test_empty),
+    KUNIT_CASE(conntable_test_insert_lookup),
+    KUNIT_CASE(conntable_test_get_put),
+    KUNIT_CASE(conntable_test_get_all),
+    KUNIT_CASE(conntable_test_get_timeout),
+    KUNIT_CASE(conntable_test_get_wait_any),
+    KUNIT_CASE(conntable_test_remove),
+    KUNIT_CASE(conntable_test_remove_race),
+    KUNIT_CASE(conntable_test_destroy_busy),
+    KUNIT_CASE(conntable_test_topk),
+    KUNIT_CASE(conntable_test_bulk_load),
+    KUNIT_CASE(conntable_test_snapshot),
+    KUNIT_CASE(conntable_bench_insert),
+    KUNIT_CASE(conntable_bench_lookup),
+    KUNIT_CASE(conntable_bench_get_put),
+    KUNIT_CASE(conntable_bench_hash),
+    {}
+};
+
+static struct kunit_suite conntable_test_suite = {
+    .name = KTEST_SUITE,
+    .init = conntable_test_init,
+    .exit = conntable_test_exit,
+    .test_cases = conntable_test_cases,
+};
+
+kunit_test_suite(conntable_test_suite);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,23 @@
+/* Connection table code of the KUnit suite
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+
+/*
+ * the sources of the stress module, built again into an object of the
+ * suite. kbuild links an object into one module only, and names it after
+ * that module. keep in line with conntable_ktest-y of the Makefile.
+ */
+#ifdef CONFIG_CACHEOBJS_CONNPOOL
+#include "connpool.c"
+#else
+#include "connhash.c"
+#endif
+#include "conntrace.c"
+#include "conntable_call.c"
+#include "conntable_buckets.c"
+#include "conntable_topk.c"
+#include "conntable_topo.c"
@@ -6,6 +6,8 @@
  * 2 of the Licence, or (at your option) any later version.
  *
  * usage: insmod conntable_ktest.ko nr_nodes=16 nr_conns=16 nr_lookup_threads=4
+ *        insmod conntable_ktest.ko nr_nodes=16 nr_conns=16 nr_mix_threads=4 \
+ *            mix_insert=10 mix_remove=10 mix_getput=80 (churn plus lookup)
  */
 #include <linux/module.h>
 #include <linux/time.h>
@@ -16,6 +18,15 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
+#include <linux/timex.h>
+#include <linux/timer.h>
+#include <linux/random.h>
+#include <linux/perf_event.h>
+#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#include <linux/firmware.h>
+#include <linux/fs.h>
 
 #include "conntable.h"
 #include "stat.h"
@@ -23,8 +34,6 @@
 MODULE_LICENSE("GPL");
 
 #define CONFIG_MAX_ALLOCATIONS
-//#define CONFIG_DELETE
-//#define CONFIG_CLEANUP
 
 #define HOSTIP	"127.0.0.1"
 
@@ -33,6 +42,13 @@ MODULE_LICENSE("GPL");
 
 #define PROCFS_CONNTABLE_TESTDIR "fs/cacheobjs_test"
 #define PROCFS_CONNTABLE_TEST_PATH "fs/cacheobjs_test/conntable"
+#define PROCFS_PRESSURE_TEST_PATH "fs/cacheobjs_test/pressure"
+#define PROCFS_TRACE_TEST_PATH "fs/cacheobjs_test/trace"
+#define PROCFS_OUTLIER_TEST_PATH "fs/cacheobjs_test/outliers"
+#define PROCFS_BUCKET_TEST_PATH "fs/cacheobjs_test/buckets"
+#define PROCFS_TOPK_TEST_PATH "fs/cacheobjs_test/topk"
+#define PROCFS_THROUGHPUT_TEST_PATH "fs/cacheobjs_test/throughput"
+#define PROCFS_WORKLOAD_TEST_PATH "fs/cacheobjs_test/workload"
 
 /* nr of nodes for test */
 static int nr_nodes = 128;
@@ -59,13 +75,227 @@ static int nr_insert_threads = 1;
 module_param(nr_insert_threads, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(nr_insert_threads, "Number of insert threads");
 
-/* nr of threads spawned for test */
-static int nr_cleanup_threads = 1;
+/* nr of threads looking up and removing connections */
+static int nr_delete_threads = 0;
+module_param(nr_delete_threads, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(nr_delete_threads, "Number of lookup and remove threads");
+
+/* nr of threads destroying the table every second */
+static int nr_cleanup_threads = 0;
 module_param(nr_cleanup_threads, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 MODULE_PARM_DESC(nr_cleanup_threads, "Number of cleanup threads");
 
+/* nr of threads dumping table stats */
+static int nr_dump_threads = 0;
+module_param(nr_dump_threads, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(nr_dump_threads, "Number of table dump threads");
+
+/*
+ * nr of threads running a mix of insert, remove, get/put and dump on
+ * each node, picked by the mix_* weights. inserts of the mix are not
+ * capped by nr_conns, so insert and remove weights set the churn.
+ */
+static int nr_mix_threads = 0;
+module_param(nr_mix_threads, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(nr_mix_threads, "Number of mixed workload threads");
+
+static unsigned int mix_insert = 10;
+module_param(mix_insert, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(mix_insert, "Insert weight of mixed workload");
+
+static unsigned int mix_remove = 10;
+module_param(mix_remove, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(mix_remove, "Remove weight of mixed workload");
+
+static unsigned int mix_getput = 80;
+module_param(mix_getput, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(mix_getput, "Get/put weight of mixed workload");
+
+static unsigned int mix_dump = 0;
+module_param(mix_dump, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(mix_dump, "Dump weight of mixed workload");
+
+/* prefer connection last used on the cpu (CONNTABLE_AFFINITY) */
+static int affinity = 0;
+module_param(affinity, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(affinity, "Enable per-cpu connection affinity");
+
+/* put hands connection to oldest waiter (CONNTABLE_HANDOFF) */
+static int handoff = 0;
+module_param(handoff, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(handoff, "Enable direct hand-off from put to waiting get");
+
+/* lease in ms for each get, 0 for no lease */
+static unsigned int lease_ms = 0;
+module_param(lease_ms, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(lease_ms, "Connection lease in ms, 0 to disable");
+
+/* lease watchdog scan interval in ms, 0 to disable */
+static unsigned int watchdog_ms = 0;
+module_param(watchdog_ms, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(watchdog_ms, "Lease watchdog interval in ms");
+
+/* watchdog recycles connections past their lease, of exited holders */
+static int lease_recycle = 0;
+module_param(lease_recycle, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(lease_recycle, "Recycle connections with expired lease whose holder exited");
+
+/* v1 getters sleep on the first busy connection, as before the waitqueue */
+static int legacy_slowpath = 0;
+module_param(legacy_slowpath, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(legacy_slowpath, "Legacy v1 get slow path");
+
+/* nr of nodes per replica group, 0 for plain node gets */
+static unsigned int group_size = 0;
+module_param(group_size, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(group_size, "Replica group size for group gets");
+
+/* route gets by object key on the consistent hash ring */
+static int key_gets = 0;
+module_param(key_gets, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(key_gets, "Get connections by object key");
+
+/* virtual nodes per pool on the hash ring, 0 for default */
+static unsigned int ring_vnodes = 0;
+module_param(ring_vnodes, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ring_vnodes, "Hash ring virtual nodes per pool");
+
+/* hedge gets on the next node in the list */
+static int hedged_gets = 0;
+module_param(hedged_gets, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(hedged_gets, "Hedge gets with the next node, needs handoff");
+
+/* wait before hedging in ms, 0 for primary pool p95 wait */
+static unsigned int hedge_after_ms = 0;
+module_param(hedge_after_ms, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(hedge_after_ms, "Hedge threshold in ms, 0 for pool p95 wait");
+
+/* per pool rate limits, 0 for unlimited */
+static unsigned long ops_limit = 0;
+module_param(ops_limit, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(ops_limit, "Per pool gets per sec limit");
+
+static unsigned long bytes_limit = 0;
+module_param(bytes_limit, ulong, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(bytes_limit, "Per pool bytes per sec limit");
+
+/* table reserve of nodes and pools, 0 for default */
+static unsigned int reserve_nr = 0;
+module_param(reserve_nr, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(reserve_nr, "Reserved nodes and pools for inserts");
+
+/* non-sleeping gets from timer (softirq) context, every jiffy */
+static int softirq_gets = 0;
+module_param(softirq_gets, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(softirq_gets, "Try gets from softirq context");
+
+/* put with read, write, meta and heartbeat op classes instead of GET */
+static int op_mix = 0;
+module_param(op_mix, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(op_mix, "Put connections with a mix of op classes");
+
+/* wait or hold time dumping the flight recorder to the kernel log */
+static unsigned int trace_threshold_us = 0;
+module_param(trace_threshold_us, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(trace_threshold_us, "Flight recorder dump threshold in us");
+
+static unsigned int outlier_us = 0;
+module_param(outlier_us, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(outlier_us, "Capture gets waiting and puts holding longer, in us");
+
+/* bytes accounted each way per get */
+static unsigned int io_bytes = 0;
+module_param(io_bytes, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(io_bytes, "Bytes sent and received per get");
+
+/* count perf events per insert, get and put of each test thread */
+static int perf_events = 0;
+module_param(perf_events, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(perf_events, "Report perf event counts per operation");
+
+/* lookup, get and put through static calls instead of the ops table */
+static int static_calls = 0;
+module_param(static_calls, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(static_calls, "Call hot table ops directly");
+
+/* topology blob (conntable_topo.h) loaded in bulk at start, under /lib/firmware */
+static char *topology = NULL;
+module_param(topology, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(topology, "Topology firmware file to bulk load");
+
+/* pools and counters saved at unload, and restored at load if there */
+static char *snapshot = NULL;
+module_param(snapshot, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(snapshot, "File to save the table to on unload and restore from on load");
+
+/* key hash of the table */
+static char *key_hash = "jhash";
+module_param(key_hash, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(key_hash, "Key hash: jhash, hsiphash or mult");
+
+/*
+ * pin test threads, thread i of each kind to the i-th cpu of the placement:
+ * none, smt (siblings of a core first), socket (cores of the first socket)
+ * or cross (cores of each socket in turn)
+ */
+static char *placement = "none";
+module_param(placement, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(placement, "Thread placement: none, smt, socket or cross");
+
+/* cpus to pin test threads to, in cpulist format, overrides placement */
+static char *cpus = NULL;
+module_param(cpus, charp, S_IRUSR | S_IRGRP | S_IROTH);
+MODULE_PARM_DESC(cpus, "Cpu list for test threads, e.g. 0,2,4-7");
+
 /* test threads */
-struct task_struct **ktest_lookup, **ktest_insert, **ktest_getput, **ktest_clear;
+struct task_struct **ktest_delete, **ktest_insert, **ktest_getput, **ktest_clear,
+    **ktest_dump, **ktest_mix;
+
+/* operations of the workload */
+typedef enum test_op {
+    TEST_INSERT = 0,
+    TEST_REMOVE,
+    TEST_GETPUT,
+    TEST_CLEANUP,
+    TEST_DUMP,
+    NR_TEST_OPS
+}test_op_t;
+
+static const char * const g_test_op_names[NR_TEST_OPS] = {
+    [TEST_INSERT] = "insert",
+    [TEST_REMOVE] = "remove",
+    [TEST_GETPUT] = "getput",
+    [TEST_CLEANUP] = "cleanup",
+    [TEST_DUMP] = "dump",
+};
+
+/* per cpu, so threads running an op do not share counters */
+struct test_op_stats {
+    struct {
+        stat64_t        nr_ops;
+        stat64_t        nr_ok;
+        stat64_t        cum_ns;
+        struct cacheobjects_hist lat_hist;
+    } op[NR_TEST_OPS];
+};
+
+static struct test_op_stats __percpu *g_op_stats;
+static ktime_t g_workload_start;
+
+/* cpus of thread placement, in pinning order */
+static int *g_thread_cpus;
+static unsigned int g_nr_thread_cpus;
+
+/* get/put progress of each thread, own cache line to not skew scaling */
+struct test_thread_stat {
+    int                 cpu;
+    u64                 nr_gets;
+    u64                 nr_hits;
+} ____cacheline_aligned_in_smp;
+
+static struct test_thread_stat *g_getput_stats;
+static atomic_t g_getput_idx;
+static ktime_t g_getput_start;
 
 typedef int (*thread_func_t) (void*);
 
@@ -82,10 +312,17 @@ struct list_head g_node_list;
 /* connection table */
 struct cacheobj_conntable glob_conntable, *g_conntable;
 
+/* connections bulk loaded at start, counted against the inserts */
+static unsigned long long g_nr_preloaded;
+
 /* connection table operations */
 static const struct cacheobj_conntable_operations *conn_ops =
 	&cacheobj_conntable_ops;
 
+/* replica groups over target nodes */
+static struct cacheobj_replica_group **g_groups;
+static unsigned int nr_groups;
+
 static int _alloc_target_nodes(void)
 {
     int i = 0;
@@ -118,12 +355,119 @@ static void _destroy_target_nodes(void)
     CONNTBL_ASSERT(nr_nodes == 0);
 }
 
+/* rate limit pools of target nodes inserted so far */
+static void _set_node_ratelimits(void)
+{
+    node_t *node;
+    unsigned int nr = 0;
+
+    list_for_each_entry(node, &g_node_list, list) {
+        if (!conn_ops->cacheobj_conntable_ratelimit(g_conntable, node->ip,
+            node->port, ops_limit, bytes_limit))
+            nr++;
+    }
+    pr_info("(%u) pools rate limited to %lu ops/s %lu bytes/s\n", nr,
+        ops_limit, bytes_limit);
+}
+
+/* split target nodes into replica groups of group_size */
+static int _alloc_replica_groups(void)
+{
+    node_t *node;
+    unsigned int i = 0;
+    const char *ip[MAX_REPLICAS];
+    unsigned int port[MAX_REPLICAS];
+    struct cacheobj_replica_group *group;
+
+    if (!group_size || !conn_ops->cacheobj_conntable_group_create)
+        return 0;
+
+    if (group_size > MAX_REPLICAS) {
+        pr_err("group size %u exceeds %u\n", group_size, MAX_REPLICAS);
+        return -EINVAL;
+    }
+
+    g_groups = kzalloc(sizeof(*g_groups) * (nr_nodes / group_size + 1),
+            GFP_KERNEL);
+    if (!g_groups)
+        return -ENOMEM;
+
+    list_for_each_entry(node, &g_node_list, list) {
+        ip[i] = node->ip;
+        port[i] = node->port;
+        if (++i < group_size)
+            continue;
+        group = conn_ops->cacheobj_conntable_group_create(g_conntable, ip,
+                port, group_size);
+        if (IS_ERR(group))
+            return PTR_ERR(group);
+        g_groups[nr_groups++] = group;
+        i = 0;
+    }
+    pr_info("(%u) replica groups allocated\n", nr_groups);
+    return 0;
+}
+
+static void _destroy_replica_groups(void)
+{
+    while (nr_groups)
+        conn_ops->cacheobj_conntable_group_destroy(g_conntable,
+                g_groups[--nr_groups]);
+    kfree(g_groups);
+    g_groups = NULL;
+}
+
+/* hot ops, direct or through the ops table for comparison */
+static inline struct cacheobj_connection_node *_lookup
+    (struct cacheobj_conntable *conntable, const char *ip, unsigned int port)
+{
+    if (static_calls)
+        return conntable_call_lookup(conntable, ip, port);
+    return conn_ops->cacheobj_conntable_lookup(conntable, ip, port);
+}
+
+static inline struct cacheobj_connection_node *_timed_get
+    (struct cacheobj_conntable *conntable, const char *ip, unsigned int port,
+     long timeout)
+{
+    if (static_calls)
+        return conntable_call_timed_get(conntable, ip, port, timeout);
+    return conn_ops->cacheobj_conntable_timed_get(conntable, ip, port,
+        timeout);
+}
+
+static inline struct cacheobj_connection_node *_leased_get
+    (struct cacheobj_conntable *conntable, const char *ip, unsigned int port,
+     long timeout, unsigned long lease)
+{
+    if (static_calls)
+        return conntable_call_leased_get(conntable, ip, port, timeout, lease);
+    return conn_ops->cacheobj_conntable_leased_get(conntable, ip, port,
+        timeout, lease);
+}
+
+static inline void _put(struct cacheobj_conntable *conntable,
+    struct cacheobj_connection_node *conn, conn_op_t op_class)
+{
+    if (static_calls)
+        conntable_call_put(conntable, conn, op_class);
+    else
+        conn_ops->cacheobj_conntable_put(conntable, conn, op_class);
+}
+
 /* create and add entry */
 static int _alloc_and_insert_entry(struct cacheobj_conntable *conntable,
         unsigned char *ip, unsigned int port)
 {
     struct cacheobj_connection_node *conn;
 
+    if (conn_ops->cacheobj_conntable_node_alloc) {
+        conn = conn_ops->cacheobj_conntable_node_alloc(conntable, ip, port);
+        if (IS_ERR(conn))
+            return PTR_ERR(conn);
+        return conn_ops->cacheobj_conntable_insert(conntable, conn);
+    }
+
     conn = (struct cacheobj_connection_node*) kzalloc
         (sizeof(struct cacheobj_connection_node), GFP_KERNEL);
     if (!conn) {
@@ -135,6 +479,137 @@ static int _alloc_and_insert_entry(struct cacheobj_conntable *conntable,
     return conn_ops->cacheobj_conntable_insert(conntable, conn);
 }
 
+/* connections of a bulk loaded blob */
+static unsigned long long _topo_nr_conns(const void *blob)
+{
+    unsigned int i;
+    unsigned long long nr = 0;
+
+    for (i = 0; i < conntable_topo_nr_nodes(blob); i++)
+        nr += le32_to_cpu(conntable_topo_node(blob, i)->nr_conns);
+    return nr;
+}
+
+/* bulk load the topology firmware, if any */
+static int _load_topology(void)
+{
+    int err;
+    ktime_t start;
+    const struct firmware *fw;
+
+    if (!topology)
+        return 0;
+    if (!conn_ops->cacheobj_conntable_bulk_load) {
+        pr_err("backend has no bulk load\n");
+        return -EOPNOTSUPP;
+    }
+    err = request_firmware(&fw, topology, NULL);
+    if (err) {
+        pr_err("topology %s not loaded, err :%d\n", topology, err);
+        return err;
+    }
+    start = ktime_get();
+    err = conn_ops->cacheobj_conntable_bulk_load(g_conntable, fw->data,
+        fw->size);
+    if (!err)
+        g_nr_preloaded += _topo_nr_conns(fw->data);
+    pr_info("<topology %s bytes :%zu err :%d load(ns) :%lld>\n", topology,
+        fw->size, err, ktime_ns_delta(ktime_get(), start));
+    release_firmware(fw);
+    return err;
+}
+
+/* release the table at unload, after its last destroy */
+static void _exit_table(void)
+{
+    if (conn_ops->cacheobj_conntable_exit)
+        conn_ops->cacheobj_conntable_exit(g_conntable);
+}
+
+/* restore the table saved by an earlier unload, if any */
+static int _restore_snapshot(void)
+{
+    int err;
+    void *blob;
+    loff_t pos = 0, size;
+    ssize_t nr;
+    ktime_t start;
+    struct file *filp;
+
+    if (!snapshot)
+        return 0;
+    if (!conn_ops->cacheobj_conntable_bulk_load) {
+        pr_err("backend has no bulk load\n");
+        return -EOPNOTSUPP;
+    }
+    filp = filp_open(snapshot, O_RDONLY, 0);
+    if (IS_ERR(filp)) {
+        err = PTR_ERR(filp);
+        if (err == -ENOENT) {
+            pr_info("no snapshot %s, starting empty\n", snapshot);
+            return 0;
+        }
+        pr_err("snapshot %s not opened, err :%d\n", snapshot, err);
+        return err;
+    }
+    size = i_size_read(file_inode(filp));
+    if (size > conntable_topo_snap_len(CONNTABLE_TOPO_MAX_NODES)) {
+        filp_close(filp, NULL);
+        return -EFBIG;
+    }
+    blob = kvmalloc(size, GFP_KERNEL);
+    if (!blob) {
+        filp_close(filp, NULL);
+        return -ENOMEM;
+    }
+    nr = kernel_read(filp, blob, size, &pos);
+    filp_close(filp, NULL);
+    if (nr != size) {
+        pr_err("snapshot %s short read :%zd/%lld\n", snapshot, nr, size);
+        kvfree(blob);
+        return (nr < 0) ? nr : -EIO;
+    }
+
+    start = ktime_get();
+    err = conn_ops->cacheobj_conntable_bulk_load(g_conntable, blob, size);
+    if (!err)
+        g_nr_preloaded += _topo_nr_conns(blob);
+    pr_info("<snapshot %s restored bytes :%lld err :%d load(ns) :%lld>\n",
+        snapshot, size, err, ktime_ns_delta(ktime_get(), start));
+    kvfree(blob);
+    return err;
+}
+
+/* save the table for the next load to restore */
+static void _save_snapshot(void)
+{
+    void *blob;
+    size_t len;
+    loff_t pos = 0;
+    ssize_t nr;
+    struct file *filp;
+
+    if (!snapshot || !conn_ops->cacheobj_conntable_snapshot)
+        return;
+    blob = conn_ops->cacheobj_conntable_snapshot(g_conntable, &len);
+    if (IS_ERR(blob)) {
+        pr_err("snapshot failed, err :%ld\n", PTR_ERR(blob));
+        return;
+    }
+    filp = filp_open(snapshot, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (IS_ERR(filp)) {
+        pr_err("snapshot %s not opened, err :%ld\n", snapshot,
+            PTR_ERR(filp));
+        kvfree(blob);
+        return;
+    }
+    nr = kernel_write(filp, blob, len, &pos);
+    filp_close(filp, NULL);
+    pr_info("<snapshot %s saved pools :%u bytes :%zd/%zu>\n", snapshot,
+        conntable_topo_nr_nodes(blob), nr, len);
+    kvfree(blob);
+}
+
 static inline void _wait_for_kthread_stop(void)
 {
     set_current_state(TASK_INTERRUPTIBLE);
@@ -145,41 +620,336 @@ static inline void _wait_for_kthread_stop(void)
     }
 }
 
+/* account an op started at start */
+static void _op_stat(test_op_t op, ktime_t start, bool ok)
+{
+    s64 ns = ktime_ns_delta(ktime_get(), start);
+    struct test_op_stats *stats;
+
+    if (!g_op_stats)
+        return;
+    // counters are atomic, migrating after the lookup is harmless
+    stats = raw_cpu_ptr(g_op_stats);
+    cacheobjects_stat64(&stats->op[op].nr_ops);
+    if (ok)
+        cacheobjects_stat64(&stats->op[op].nr_ok);
+    cacheobjects_stat64_add(ns, &stats->op[op].cum_ns);
+    cacheobjects_hist_add(&stats->op[op].lat_hist, ns);
+}
+
+/* throughput and latency of each op since the workload started */
+static void _dump_workload(struct seq_file *m)
+{
+    int cpu, i, j;
+    u64 nr_ops, nr_ok, cum_ns, elapsed_ns;
+    struct test_op_stats *stats;
+    struct cacheobjects_hist *hist;
+
+    if (!g_op_stats)
+        return;
+
+    hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+    if (!hist)
+        return;
+
+    elapsed_ns = ktime_ns_delta(ktime_get(), g_workload_start);
+    for (i = 0; i < NR_TEST_OPS; i++) {
+        nr_ops = nr_ok = cum_ns = 0;
+        cacheobjects_hist_reset(hist);
+        for_each_possible_cpu(cpu) {
+            stats = per_cpu_ptr(g_op_stats, cpu);
+            nr_ops += cacheobjects_stat64_read(&stats->op[i].nr_ops);
+            nr_ok += cacheobjects_stat64_read(&stats->op[i].nr_ok);
+            cum_ns += cacheobjects_stat64_read(&stats->op[i].cum_ns);
+            for (j = 0; j < CACHEOBJS_HIST_BUCKETS; j++)
+                atomic64_add(atomic64_read(&stats->op[i].lat_hist.bucket[j]),
+                    &hist->bucket[j]);
+        }
+        if (!nr_ops)
+            continue;
+        if (m)
+            seq_printf(m, "op %s nr_ops :%llu ok :%llu ops/s :%llu "
+                "avg(ns) :%lu p50(ns) :%llu p99(ns) :%llu\n",
+                g_test_op_names[i], nr_ops, nr_ok,
+                div64_u64(nr_ops * NSEC_PER_SEC, elapsed_ns ? : 1),
+                div64_safe(cum_ns, nr_ops),
+                cacheobjects_hist_percentile(hist, 50),
+                cacheobjects_hist_percentile(hist, 99));
+        else
+            pr_info("<op %s nr_ops :%llu ok :%llu ops/s :%llu avg(ns) :%lu "
+                "p99(ns) :%llu>\n", g_test_op_names[i], nr_ops, nr_ok,
+                div64_u64(nr_ops * NSEC_PER_SEC, elapsed_ns ? : 1),
+                div64_safe(cum_ns, nr_ops),
+                cacheobjects_hist_percentile(hist, 99));
+    }
+    kfree(hist);
+}
+
+/* registered op classes for op_mix */
+static const char * const g_op_names[] = { "read", "write", "meta",
+    "heartbeat" };
+static conn_op_t g_op_classes[ARRAY_SIZE(g_op_names)];
+static unsigned int nr_op_classes;
+
+static int _register_op_classes(void)
+{
+    int id;
+
+    for (nr_op_classes = 0; nr_op_classes < ARRAY_SIZE(g_op_names);
+        nr_op_classes++) {
+        id = conn_ops->cacheobj_conntable_op_register(g_conntable,
+            g_op_names[nr_op_classes]);
+        if (id < 0)
+            return id;
+        g_op_classes[nr_op_classes] = id;
+    }
+    return 0;
+}
+
+/* op class to put with */
+static inline conn_op_t _next_op_class(void)
+{
+    if (!nr_op_classes)
+        return GET;
+    return g_op_classes[get_random_u32_below(nr_op_classes)];
+}
+
+/* softirq getter state */
+static struct timer_list g_softirq_timer;
+static bool g_softirq_started;
+static unsigned int g_softirq_port;
+static atomic64_t g_softirq_hits, g_softirq_misses;
+
+/* try get and put on next node, from timer softirq */
+static void _softirq_get_and_put_entry(struct timer_list *t)
+{
+    struct cacheobj_connection_node *conn;
+
+    g_softirq_port = (g_softirq_port % nr_nodes) + 1;
+    conn = conn_ops->cacheobj_conntable_try_get(g_conntable, HOSTIP,
+        g_softirq_port);
+    if (!IS_ERR_OR_NULL(conn)) {
+        conn_ops->cacheobj_conntable_put(g_conntable, conn, GET);
+        atomic64_inc(&g_softirq_hits);
+    } else {
+        atomic64_inc(&g_softirq_misses);
+    }
+    mod_timer(t, jiffies + 1);
+}
+
+/*
+ * perf events counted per test thread. hardware events missing on the cpu
+ * (or without a pmu, as on most vms) are skipped, software ones always open.
+ */
+static const struct test_perf_event {
+    const char          *name;
+    u32                 type;
+    u64                 config;
+} g_perf_events[] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    // lines pulled from another numa node
+    { "node_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    { "cpu_migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+};
+
+#define NR_PERF_EVENTS ARRAY_SIZE(g_perf_events)
+
+typedef enum test_perf_phase {
+    PERF_INSERT = 0,
+    PERF_GET,
+    PERF_PUT,
+    NR_PERF_PHASES
+}test_perf_phase_t;
+
+static const char * const g_perf_phases[NR_PERF_PHASES] = {
+    [PERF_INSERT] = "insert",
+    [PERF_GET] = "get",
+    [PERF_PUT] = "put",
+};
+
+/* counters of a test thread */
+struct test_perf {
+    struct perf_event   *ev[NR_PERF_EVENTS]; // NULL if unavailable
+    u64                 start[NR_PERF_EVENTS];
+    u64                 total[NR_PERF_PHASES][NR_PERF_EVENTS];
+    u64                 nr_ops[NR_PERF_PHASES];
+};
+
+/* totals of exited test threads */
+static DEFINE_MUTEX(g_perf_lock);
+static u64 g_perf_total[NR_PERF_PHASES][NR_PERF_EVENTS];
+static u64 g_perf_ops[NR_PERF_PHASES];
+static u64 g_perf_enabled[NR_PERF_EVENTS], g_perf_running[NR_PERF_EVENTS];
+
+/* open counters on the calling thread, NULL if perf_events is off */
+static struct test_perf *_perf_open(void)
+{
+    unsigned int i;
+    struct test_perf *perf;
+    struct perf_event_attr attr;
+
+    if (!perf_events)
+        return NULL;
+
+    perf = kzalloc(sizeof(*perf), GFP_KERNEL);
+    if (!perf)
+        return NULL;
+
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = g_perf_events[i].type;
+        attr.size = sizeof(attr);
+        attr.config = g_perf_events[i].config;
+        attr.exclude_hv = 1;
+        perf->ev[i] = perf_event_create_kernel_counter(&attr, -1, current,
+            NULL, NULL);
+        if (IS_ERR(perf->ev[i])) {
+            pr_debug("perf event %s unavailable (%ld)\n",
+                g_perf_events[i].name, PTR_ERR(perf->ev[i]));
+            perf->ev[i] = NULL;
+        }
+    }
+    return perf;
+}
+
+static void _perf_start(struct test_perf *perf)
+{
+    unsigned int i;
+    u64 enabled, running;
+
+    if (!perf)
+        return;
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        if (perf->ev[i])
+            perf->start[i] = perf_event_read_value(perf->ev[i], &enabled,
+                &running);
+    }
+}
+
+/* charge counts since _perf_start to phase, reads are part of the count */
+static void _perf_stop(struct test_perf *perf, test_perf_phase_t phase)
+{
+    unsigned int i;
+    u64 enabled, running;
+
+    if (!perf)
+        return;
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        if (perf->ev[i])
+            perf->total[phase][i] += perf_event_read_value(perf->ev[i],
+                &enabled, &running) - perf->start[i];
+    }
+    perf->nr_ops[phase]++;
+}
+
+/* add thread counts to totals and close its counters */
+static void _perf_close(struct test_perf *perf)
+{
+    unsigned int i, j;
+    u64 enabled, running;
+
+    if (!perf)
+        return;
+
+    mutex_lock(&g_perf_lock);
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        if (!perf->ev[i])
+            continue;
+        perf_event_read_value(perf->ev[i], &enabled, &running);
+        g_perf_enabled[i] += enabled;
+        g_perf_running[i] += running;
+        for (j = 0; j < NR_PERF_PHASES; j++)
+            g_perf_total[j][i] += perf->total[j][i];
+    }
+    for (j = 0; j < NR_PERF_PHASES; j++)
+        g_perf_ops[j] += perf->nr_ops[j];
+    mutex_unlock(&g_perf_lock);
+
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        if (perf->ev[i])
+            perf_event_release_kernel(perf->ev[i]);
+    }
+    kfree(perf);
+}
+
+/*
+ * per op average of each event and phase. counts of multiplexed events are
+ * not scaled, their running share (%) is reported instead.
+ */
+static void _perf_report(void)
+{
+    unsigned int i, j;
+
+    if (!perf_events)
+        return;
+
+    for (i = 0; i < NR_PERF_EVENTS; i++) {
+        if (!g_perf_enabled[i]) {
+            pr_info("<perf %s unavailable>\n", g_perf_events[i].name);
+            continue;
+        }
+        pr_info("<perf %s running :%lu%%>\n", g_perf_events[i].name,
+            div64_safe(g_perf_running[i] * 100, g_perf_enabled[i]));
+        for (j = 0; j < NR_PERF_PHASES; j++) {
+            if (!g_perf_ops[j])
+                continue;
+            pr_info("<perf %s %s/op :%lu (nr_ops :%llu)>\n", g_perf_phases[j],
+                g_perf_events[i].name, div64_safe(g_perf_total[j][i],
+                g_perf_ops[j]), g_perf_ops[j]);
+        }
+    }
+}
+
 /* thread worker function to insert entries */
 static int threadfn_test_insert(void *arg)
 {
-    ktime_t start;
+    ktime_t start, op_start;
     node_t *node, *tmp;
     unsigned long long items = 0;
     struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
+    struct test_perf *perf = _perf_open();
 
     start = ktime_get();
 
     while(!list_empty(&g_node_list)) {
+#ifdef CONFIG_MAX_ALLOCATIONS
+        // a loaded topology or snapshot already holds its share
+        if (items + g_nr_preloaded >= nr_conns * nr_nodes)
+            break;
+#endif
         list_for_each_entry_safe(node, tmp, &g_node_list, list) {
             if (kthread_should_stop())
                 goto exit;
 
+            op_start = ktime_get();
+            _perf_start(perf);
             if (_alloc_and_insert_entry(conntable, node->ip, node->port) < 0) {
+                _op_stat(TEST_INSERT, op_start, false);
                 pr_err("insert failed (%llu)\n", items);
                 goto exit;
             }
+            _perf_stop(perf, PERF_INSERT);
+            _op_stat(TEST_INSERT, op_start, true);
             items++;
             yield();
         }
-#ifdef CONFIG_MAX_ALLOCATIONS
-        if (items >= nr_conns * nr_nodes)
-            break;
-#endif
     }
 exit:
     pr_info("<nr_inserted :%llu, avg_time :%lu (ns)>\n", items,
 	div64_safe(ktime_ns_delta(ktime_get(), start), items));
+    _perf_close(perf);
     _wait_for_kthread_stop();
     return 0;
 }
 
-#ifdef CONFIG_DELETE
 /* lookup and clear entry */
 static bool _find_and_delete_entry(struct cacheobj_conntable *conntable,
         unsigned char *ip, unsigned int port)
@@ -187,11 +957,14 @@ static bool _find_and_delete_entry(struct cacheobj_conntable *conntable,
     struct cacheobj_connection_node *conn;
     bool deleted = false;
 
-    conn = conn_ops->cacheobj_conntable_lookup(conntable, ip, port);
+    conn = _lookup(conntable, ip, port);
     if (conn) {
         CONNTBL_ASSERT(!IS_ERR(conn));
         if (conn_ops->cacheobj_conntable_remove(conntable, conn) == 0) {
-            kfree(conn);
+            if (conn_ops->cacheobj_conntable_node_free)
+                conn_ops->cacheobj_conntable_node_free(conntable, conn);
+            else
+                kfree(conn);
             deleted = true;
         }
     }
@@ -201,7 +974,8 @@ static bool _find_and_delete_entry(struct cacheobj_conntable *conntable,
 /* thread worker function to lookup and delete entries */
 static int threadfn_test_delete(void *arg)
 {
-    ktime_t start;
+    bool ok;
+    ktime_t start, op_start;
     node_t *node, *tmp;
     unsigned long long items = 0, success = 0;
     struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
@@ -211,37 +985,113 @@ static int threadfn_test_delete(void *arg)
         list_for_each_entry_safe(node, tmp, &g_node_list, list) {
             if (kthread_should_stop())
                 goto exit;
-            if (_find_and_delete_entry(conntable, node->ip, node->port))
+            op_start = ktime_get();
+            ok = _find_and_delete_entry(conntable, node->ip, node->port);
+            _op_stat(TEST_REMOVE, op_start, ok);
+            if (ok)
                 success++;
+            items++;
             yield();
         }
     }
 exit:
-    pr_info("<nr_lookups :%llu, hits :%llu avg_time :%llu (ns)>\n", items,
+    pr_info("<nr_lookups :%llu, hits :%llu avg_time :%lu (ns)>\n", items,
             success, div64_safe(ktime_ns_delta(ktime_get(), start), items));
     return 0;
 }
-#endif
 
 /* lookup and clear entry */
 static int _get_and_put_entry(struct cacheobj_conntable *conntable,
-        unsigned char *ip, unsigned int port)
+        unsigned char *ip, unsigned int port, struct test_perf *perf)
 {
     struct cacheobj_connection_node *conn;
 
-    conn = conn_ops->cacheobj_conntable_timed_get(conntable, ip, port,
-	WAIT_FOR_READY_CONN_TIMEOUT);
+    _perf_start(perf);
+    if (key_gets && conn_ops->cacheobj_conntable_key_get) {
+        // any object key will do, spread by the ring
+        u64 key = get_cycles();
+        conn = conn_ops->cacheobj_conntable_key_get(conntable, &key,
+            sizeof(key), WAIT_FOR_READY_CONN_TIMEOUT);
+    } else if (lease_ms)
+        conn = _leased_get(conntable, ip, port,
+            WAIT_FOR_READY_CONN_TIMEOUT, msecs_to_jiffies(lease_ms));
+    else
+        conn = _timed_get(conntable, ip, port,
+            WAIT_FOR_READY_CONN_TIMEOUT);
     if (!conn)
         return -ENOENT;
 
     if (IS_ERR(conn))
         return PTR_ERR(conn);
+    _perf_stop(perf, PERF_GET);
 
     /* inject delay */
     if (put_delay_us)
         usleep_range(put_delay_us, put_delay_us);
 
-    conn_ops->cacheobj_conntable_put(conntable, conn, GET);
+    if (io_bytes)
+        conn_ops->cacheobj_conntable_account(conntable, conn, io_bytes,
+            io_bytes);
+
+    _perf_start(perf);
+    _put(conntable, conn, _next_op_class());
+    _perf_stop(perf, PERF_PUT);
+    return 0;
+}
+
+/* hedged get on node and the one after it, and put */
+static int _hedged_get_and_put_entry(struct cacheobj_conntable *conntable,
+        node_t *node, struct test_perf *perf)
+{
+    node_t *hedge;
+    struct cacheobj_connection_node *conn;
+
+    hedge = list_is_last(&node->list, &g_node_list) ?
+        list_first_entry(&g_node_list, node_t, list) :
+        list_next_entry(node, list);
+
+    _perf_start(perf);
+    conn = conn_ops->cacheobj_conntable_hedged_get(conntable, node->ip,
+            node->port, hedge->ip, hedge->port, WAIT_FOR_READY_CONN_TIMEOUT,
+            msecs_to_jiffies(hedge_after_ms));
+    if (!conn)
+        return -ENOENT;
+
+    if (IS_ERR(conn))
+        return PTR_ERR(conn);
+    _perf_stop(perf, PERF_GET);
+
+    if (put_delay_us)
+        usleep_range(put_delay_us, put_delay_us);
+
+    _perf_start(perf);
+    _put(conntable, conn, _next_op_class());
+    _perf_stop(perf, PERF_PUT);
+    return 0;
+}
+
+/* get from a replica group and put */
+static int _group_get_and_put_entry(struct cacheobj_conntable *conntable,
+        struct cacheobj_replica_group *group, struct test_perf *perf)
+{
+    struct cacheobj_connection_node *conn;
+
+    _perf_start(perf);
+    conn = conn_ops->cacheobj_conntable_group_get(conntable, group,
+            WAIT_FOR_READY_CONN_TIMEOUT);
+    if (!conn)
+        return -ENOENT;
+
+    if (IS_ERR(conn))
+        return PTR_ERR(conn);
+    _perf_stop(perf, PERF_GET);
+
+    if (put_delay_us)
+        usleep_range(put_delay_us, put_delay_us);
+
+    _perf_start(perf);
+    _put(conntable, conn, _next_op_class());
+    _perf_stop(perf, PERF_PUT);
     return 0;
 }
 
@@ -249,49 +1099,185 @@ static int _get_and_put_entry(struct cacheobj_conntable *conntable,
 static int threadfn_test_getput(void *arg)
 {
     int err = 0;
-    ktime_t start;
+    ktime_t start, op_start;
     node_t *node, *tmp;
-    unsigned long long items = 0, success = 0;
+    unsigned int i;
+    unsigned long long items = 0, success = 0, throttled = 0;
     struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
+    struct test_perf *perf = _perf_open();
+    struct test_thread_stat *stat = NULL;
+
+    i = atomic_inc_return(&g_getput_idx) - 1;
+    if (g_getput_stats && (i < nr_lookup_threads)) {
+        stat = &g_getput_stats[i];
+        stat->cpu = raw_smp_processor_id();
+    }
 
     start = ktime_get();
+    while (nr_groups) {
+        for (i = 0; i < nr_groups; i++) {
+            if (kthread_should_stop())
+                goto exit;
+
+            op_start = ktime_get();
+            err = _group_get_and_put_entry(conntable, g_groups[i], perf);
+            _op_stat(TEST_GETPUT, op_start, !err);
+            if (err == -EBUSY)
+                throttled++;
+            else if (err && err != -ENOENT)
+                pr_err("group get failed with %d\n", err);
+            else if (!err)
+                success++;
+
+            items++;
+            if (stat) {
+                WRITE_ONCE(stat->nr_gets, items);
+                WRITE_ONCE(stat->nr_hits, success);
+            }
+            yield();
+        }
+    }
+
     while(!list_empty(&g_node_list)) {
         list_for_each_entry_safe(node, tmp, &g_node_list, list) {
             if (kthread_should_stop())
                 goto exit;
 
-            err = _get_and_put_entry(conntable, node->ip, node->port);
-            if (err && err != -ENOENT)
+            op_start = ktime_get();
+            if (hedged_gets && handoff &&
+                conn_ops->cacheobj_conntable_hedged_get)
+                err = _hedged_get_and_put_entry(conntable, node, perf);
+            else
+                err = _get_and_put_entry(conntable, node->ip, node->port,
+                    perf);
+            _op_stat(TEST_GETPUT, op_start, !err);
+            if (err == -EBUSY)
+                throttled++;
+            else if (err && err != -ENOENT)
                 pr_err("get failed with %d\n", err);
             else if (!err)
                 success++;
 
             items++;
+            if (stat) {
+                WRITE_ONCE(stat->nr_gets, items);
+                WRITE_ONCE(stat->nr_hits, success);
+            }
             yield();
         }
 	//msleep(50);
     }
 
 exit:
-    pr_info("<nr_gets :%llu, hits :%llu avg_time :%lu (ns)>\n", items,
-            success, div64_safe(ktime_ns_delta(ktime_get(), start), items));
+    pr_info("<nr_gets :%llu, hits :%llu throttled :%llu avg_time :%lu (ns)>\n",
+            items, success, throttled, div64_safe(ktime_ns_delta(ktime_get(), start), items));
+    _perf_close(perf);
     _wait_for_kthread_stop();
     return 0;
 }
 
-#ifdef CONFIG_CLEANUP
 /* thread worker function to clear table */
 static int threadfn_test_clear(void *arg)
 {
+    ktime_t op_start;
     struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
     while (!kthread_should_stop()) {
+        op_start = ktime_get();
         conn_ops->cacheobj_conntable_destroy(conntable);
+        _op_stat(TEST_CLEANUP, op_start, true);
         msleep(1000);
         yield();
     }
     return 0;
 }
-#endif
+
+/* dump table into a scratch page, output past it is dropped */
+static void _dump_table(struct cacheobj_conntable *conntable,
+        struct seq_file *m)
+{
+    ktime_t op_start = ktime_get();
+
+    m->count = 0;
+    conn_ops->cacheobj_conntable_dump(conntable, m);
+    _op_stat(TEST_DUMP, op_start, true);
+}
+
+static int _alloc_dump_buffer(struct seq_file *m)
+{
+    memset(m, 0, sizeof(*m));
+    m->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if (!m->buf)
+        return -ENOMEM;
+    m->size = PAGE_SIZE;
+    return 0;
+}
+
+/* thread worker function to dump table stats */
+static int threadfn_test_dump(void *arg)
+{
+    struct seq_file m;
+    struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
+
+    if (_alloc_dump_buffer(&m) < 0)
+        goto exit;
+    while (!kthread_should_stop()) {
+        _dump_table(conntable, &m);
+        yield();
+    }
+    kfree(m.buf);
+    return 0;
+exit:
+    _wait_for_kthread_stop();
+    return 0;
+}
+
+/* thread worker function running the mix_* weighted workload on each node */
+static int threadfn_test_mix(void *arg)
+{
+    int err;
+    bool ok;
+    ktime_t op_start;
+    node_t *node, *tmp;
+    struct seq_file m = { 0 };
+    unsigned int pick, total;
+    // weights as of thread start, params may change under us
+    unsigned int w_insert = mix_insert, w_remove = mix_remove,
+        w_getput = mix_getput, w_dump = mix_dump;
+    struct cacheobj_conntable *conntable = (struct cacheobj_conntable*) arg;
+
+    total = w_insert + w_remove + w_getput + w_dump;
+    if (!total || (w_dump && (_alloc_dump_buffer(&m) < 0))) {
+        _wait_for_kthread_stop();
+        return 0;
+    }
+
+    while(!list_empty(&g_node_list)) {
+        list_for_each_entry_safe(node, tmp, &g_node_list, list) {
+            if (kthread_should_stop())
+                goto exit;
+
+            pick = get_random_u32_below(total);
+            op_start = ktime_get();
+            if (pick < w_insert) {
+                err = _alloc_and_insert_entry(conntable, node->ip, node->port);
+                _op_stat(TEST_INSERT, op_start, !err);
+            } else if ((pick -= w_insert) < w_remove) {
+                ok = _find_and_delete_entry(conntable, node->ip, node->port);
+                _op_stat(TEST_REMOVE, op_start, ok);
+            } else if ((pick -= w_remove) < w_getput) {
+                err = _get_and_put_entry(conntable, node->ip, node->port,
+                    NULL);
+                _op_stat(TEST_GETPUT, op_start, !err);
+            } else {
+                _dump_table(conntable, &m);
+            }
+            yield();
+        }
+    }
+exit:
+    kfree(m.buf);
+    return 0;
+}
 
 /* stops all active threads */
 static void stop_test_threads(struct task_struct **ktask,
@@ -312,6 +1298,103 @@ static void stop_test_threads(struct task_struct **ktask,
     kfree(ktask);
 }
 
+/* add cpu to placement once */
+static inline void _add_thread_cpu(int cpu, struct cpumask *taken)
+{
+    if (!cpu_online(cpu) || cpumask_test_cpu(cpu, taken))
+        return;
+    cpumask_set_cpu(cpu, taken);
+    g_thread_cpus[g_nr_thread_cpus++] = cpu;
+}
+
+/* first smt sibling stands for its core */
+static inline bool _is_core_cpu(int cpu)
+{
+    return cpu == cpumask_first(topology_sibling_cpumask(cpu));
+}
+
+/* order online cpus by placement, nothing to pin for none */
+static int _alloc_thread_cpus(void)
+{
+    int cpu, sib;
+    bool added;
+    unsigned int pass;
+    cpumask_var_t taken, list;
+    const struct cpumask *socket;
+
+    if (!cpus && (!placement || !strcmp(placement, "none")))
+        return 0;
+
+    g_thread_cpus = kcalloc(nr_cpu_ids, sizeof(int), GFP_KERNEL);
+    if (!g_thread_cpus)
+        return -ENOMEM;
+    if (!zalloc_cpumask_var(&taken, GFP_KERNEL))
+        return -ENOMEM;
+
+    if (cpus) {
+        if (!zalloc_cpumask_var(&list, GFP_KERNEL)) {
+            free_cpumask_var(taken);
+            return -ENOMEM;
+        }
+        if (!cpulist_parse(cpus, list)) {
+            for_each_cpu(cpu, list)
+                _add_thread_cpu(cpu, taken);
+        }
+        free_cpumask_var(list);
+    } else if (!strcmp(placement, "smt")) {
+        for_each_online_cpu(cpu) {
+            for_each_cpu(sib, topology_sibling_cpumask(cpu))
+                _add_thread_cpu(sib, taken);
+        }
+    } else if (!strcmp(placement, "socket")) {
+        // a core each before smt siblings
+        socket = topology_core_cpumask(cpumask_first(cpu_online_mask));
+        for (pass = 0; pass < 2; pass++) {
+            for_each_cpu(cpu, socket) {
+                if (pass || _is_core_cpu(cpu))
+                    _add_thread_cpu(cpu, taken);
+            }
+        }
+    } else if (!strcmp(placement, "cross")) {
+        // next free core of each socket in turn
+        do {
+            added = false;
+            for_each_online_cpu(sib) {
+                if (sib != cpumask_first(topology_core_cpumask(sib)))
+                    continue;
+                for_each_cpu(cpu, topology_core_cpumask(sib)) {
+                    if (cpu_online(cpu) && _is_core_cpu(cpu) &&
+                        !cpumask_test_cpu(cpu, taken)) {
+                        _add_thread_cpu(cpu, taken);
+                        added = true;
+                        break;
+                    }
+                }
+            }
+        } while (added);
+    } else {
+        pr_err("unknown placement %s\n", placement);
+        free_cpumask_var(taken);
+        return -EINVAL;
+    }
+    free_cpumask_var(taken);
+
+    if (!g_nr_thread_cpus) {
+        pr_err("no online cpus for placement\n");
+        return -EINVAL;
+    }
+    pr_info("(%u) cpus for %s placement\n", g_nr_thread_cpus,
+        cpus ? "cpulist" : placement);
+    return 0;
+}
+
+static void _destroy_thread_cpus(void)
+{
+    kfree(g_thread_cpus);
+    g_thread_cpus = NULL;
+    g_nr_thread_cpus = 0;
+}
+
 static struct task_struct **spawn_test_threads(thread_func_t func, void *args,
         unsigned int nr_threads, const char* name)
 {
@@ -325,11 +1408,15 @@ static struct task_struct **spawn_test_threads(thread_func_t func, void *args,
     }
 
     for(i = 0; i < nr_threads; i++) {
-        ktask[i] = kthread_run(func, args, name);
+        ktask[i] = kthread_create(func, args, name);
         if (IS_ERR(ktask[i])) {
             pr_err("error launching kthread\n");
             goto err;
         }
+        // threads beyond the placement share its cpus again
+        if (g_nr_thread_cpus)
+            kthread_bind(ktask[i], g_thread_cpus[i % g_nr_thread_cpus]);
+        wake_up_process(ktask[i]);
     }
     return ktask;
 
@@ -357,18 +1444,201 @@ static const struct file_operations test_proc_fops = {
     .release    = single_release,
 };
 
+static int pressure_proc_dump(struct seq_file *m, void *v)
+{
+    conn_ops->cacheobj_conntable_pressure_dump(g_conntable, m);
+    return 0;
+}
+
+static int pressure_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, pressure_proc_dump, NULL);
+}
+
+static const struct file_operations pressure_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = pressure_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static int trace_proc_dump(struct seq_file *m, void *v)
+{
+    conn_ops->cacheobj_conntable_trace_dump(g_conntable, m);
+    return 0;
+}
+
+static int trace_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, trace_proc_dump, NULL);
+}
+
+static const struct file_operations trace_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = trace_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static int outlier_proc_dump(struct seq_file *m, void *v)
+{
+    conn_ops->cacheobj_conntable_outlier_dump(g_conntable, m);
+    return 0;
+}
+
+static int outlier_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, outlier_proc_dump, NULL);
+}
+
+static const struct file_operations outlier_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = outlier_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static int bucket_proc_dump(struct seq_file *m, void *v)
+{
+    conn_ops->cacheobj_conntable_bucket_dump(g_conntable, m);
+    return 0;
+}
+
+static int bucket_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, bucket_proc_dump, NULL);
+}
+
+static const struct file_operations bucket_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = bucket_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static int topk_proc_dump(struct seq_file *m, void *v)
+{
+    conn_ops->cacheobj_conntable_topk_dump(g_conntable, m);
+    return 0;
+}
+
+static int topk_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, topk_proc_dump, NULL);
+}
+
+static const struct file_operations topk_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = topk_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* get/put throughput since the threads were launched */
+static void _dump_throughput(struct seq_file *m)
+{
+    unsigned int i;
+    u64 gets = 0, hits = 0, elapsed_ns;
+    struct test_thread_stat *stat;
+
+    if (!g_getput_stats)
+        return;
+
+    elapsed_ns = ktime_ns_delta(ktime_get(), g_getput_start);
+    for (i = 0; i < nr_lookup_threads; i++) {
+        stat = &g_getput_stats[i];
+        gets += READ_ONCE(stat->nr_gets);
+        hits += READ_ONCE(stat->nr_hits);
+        if (m)
+            seq_printf(m, "thread %u cpu %d gets :%llu hits :%llu\n", i,
+                stat->cpu, READ_ONCE(stat->nr_gets), READ_ONCE(stat->nr_hits));
+    }
+    if (m)
+        seq_printf(m, "placement %s threads :%d gets :%llu hits :%llu "
+            "elapsed(ms) :%llu gets/s :%llu\n", cpus ? cpus : placement,
+            nr_lookup_threads, gets, hits, elapsed_ns / NSEC_PER_MSEC,
+            div64_u64(gets * NSEC_PER_SEC, elapsed_ns ? : 1));
+    else
+        pr_info("<placement %s threads :%d gets :%llu hits :%llu gets/s "
+            ":%llu>\n", cpus ? cpus : placement, nr_lookup_threads, gets,
+            hits, div64_u64(gets * NSEC_PER_SEC, elapsed_ns ? : 1));
+}
+
+static int throughput_proc_dump(struct seq_file *m, void *v)
+{
+    _dump_throughput(m);
+    return 0;
+}
+
+static int throughput_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, throughput_proc_dump, NULL);
+}
+
+static const struct file_operations throughput_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = throughput_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+static int workload_proc_dump(struct seq_file *m, void *v)
+{
+    _dump_workload(m);
+    return 0;
+}
+
+static int workload_proc_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, workload_proc_dump, NULL);
+}
+
+static const struct file_operations workload_proc_fops = {
+    .owner      = THIS_MODULE,
+    .open       = workload_proc_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
 static void stop_and_cleanup_module(void)
 {
     pr_info("stopping stress test...\n");
 
-    stop_test_threads(ktest_lookup, nr_lookup_threads);
+    if (g_softirq_started) {
+        del_timer_sync(&g_softirq_timer);
+        pr_info("<softirq try gets hits :%lld misses :%lld>\n",
+            atomic64_read(&g_softirq_hits), atomic64_read(&g_softirq_misses));
+    }
+    stop_test_threads(ktest_delete, nr_delete_threads);
+    stop_test_threads(ktest_mix, nr_mix_threads);
+    stop_test_threads(ktest_dump, nr_dump_threads);
     stop_test_threads(ktest_insert, nr_insert_threads);
     stop_test_threads(ktest_getput, nr_lookup_threads);
     stop_test_threads(ktest_clear, nr_cleanup_threads);
+    _dump_throughput(NULL);
+    _dump_workload(NULL);
+    free_percpu(g_op_stats);
+    g_op_stats = NULL;
+    kfree(g_getput_stats);
+    g_getput_stats = NULL;
+    _destroy_thread_cpus();
+    _perf_report();
+    if (conn_ops->cacheobj_conntable_watchdog)
+        conn_ops->cacheobj_conntable_watchdog(g_conntable, 0);
+    _destroy_replica_groups();
+    _save_snapshot();
     if (conn_ops->cacheobj_conntable_destroy(g_conntable))
         pr_err("hash table is not empty !!!\n");
     _destroy_target_nodes();
     remove_proc_subtree(PROCFS_CONNTABLE_TESTDIR, NULL);
+    _exit_table();
 }
 
 static int __init start_module(void)
@@ -378,12 +1648,69 @@ static int __init start_module(void)
     pr_info("starting connection table stress test...\n");
 
     INIT_LIST_HEAD(&g_node_list);
-    conn_ops->cacheobj_conntable_init(&glob_conntable);
+    glob_conntable.flags = (affinity ? CONNTABLE_AFFINITY : 0) |
+        (handoff ? CONNTABLE_HANDOFF : 0) |
+        (lease_recycle ? CONNTABLE_LEASE_RECYCLE : 0) |
+        (legacy_slowpath ? CONNTABLE_LEGACY_SLOWPATH : 0);
+    glob_conntable.ring_vnodes = ring_vnodes;
+    glob_conntable.reserve_nr = reserve_nr;
+    glob_conntable.trace_threshold_ns = (u64)trace_threshold_us * NSEC_PER_USEC;
+    glob_conntable.outlier_threshold_ns = (u64)outlier_us * NSEC_PER_USEC;
+    err = conntable_hash_parse(key_hash);
+    if (err < 0) {
+        pr_err("unknown key hash %s\n", key_hash);
+        return err;
+    }
+    glob_conntable.hash.fn = err;
+    err = conn_ops->cacheobj_conntable_init(&glob_conntable);
+    if (err) {
+        pr_err("conntable init failed with %d\n", err);
+        return err;
+    }
     g_conntable = &glob_conntable;
+    cacheobj_conntable_ops_install(conn_ops);
+
+    err = _load_topology();
+    if (!err)
+        err = _restore_snapshot();
+    if (err) {
+        conn_ops->cacheobj_conntable_destroy(g_conntable);
+        _exit_table();
+        return err;
+    }
+
+    err = _alloc_thread_cpus();
+    if (err) {
+        _destroy_thread_cpus();
+        conn_ops->cacheobj_conntable_destroy(g_conntable);
+        _exit_table();
+        return err;
+    }
+
+    if (watchdog_ms && conn_ops->cacheobj_conntable_watchdog)
+        conn_ops->cacheobj_conntable_watchdog(g_conntable,
+            msecs_to_jiffies(watchdog_ms));
 
     // free node entries only during cleanup module
     _alloc_target_nodes();
 
+    err = _alloc_replica_groups();
+    if (err)
+        goto fail_startup;
+
+    if (op_mix && conn_ops->cacheobj_conntable_op_register) {
+        err = _register_op_classes();
+        if (err)
+            goto fail_startup;
+    }
+
+    g_op_stats = alloc_percpu(struct test_op_stats);
+    if (!g_op_stats) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    g_workload_start = ktime_get();
+
     ktest_insert = spawn_test_threads(threadfn_test_insert, (void*)g_conntable,
             nr_insert_threads, "ktest_insert");
     if (!ktest_insert) {
@@ -391,18 +1718,27 @@ static int __init start_module(void)
         goto fail_startup;
     }
 
-#ifdef CONFIG_DELETE
-    ktest_lookup = spawn_test_threads(threadfn_test_delete, (void*)g_conntable,
-            nr_lookup_threads, "ktest_lookup");
-    if (!ktest_lookup) {
-        err = -ENOMEM;
-        goto fail_startup;
+    if (nr_delete_threads) {
+        ktest_delete = spawn_test_threads(threadfn_test_delete,
+                (void*)g_conntable, nr_delete_threads, "ktest_delete");
+        if (!ktest_delete) {
+            err = -ENOMEM;
+            goto fail_startup;
+        }
     }
-#endif
 
     msleep(1000);
+    if ((ops_limit || bytes_limit) && conn_ops->cacheobj_conntable_ratelimit)
+        _set_node_ratelimits();
     pr_info("launching get/put threads...\n");
 
+    g_getput_stats = kcalloc(nr_lookup_threads, sizeof(*g_getput_stats),
+            GFP_KERNEL);
+    if (!g_getput_stats) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    g_getput_start = ktime_get();
     ktest_getput = spawn_test_threads(threadfn_test_getput, (void*)g_conntable,
             nr_lookup_threads, "ktest_getput");
     if (!ktest_getput) {
@@ -410,14 +1746,38 @@ static int __init start_module(void)
         goto fail_startup;
     }
 
-#ifdef CONFIG_CLEANUP
-    ktest_clear = spawn_test_threads(threadfn_test_clear, (void*)g_conntable,
-            nr_cleanup_threads, "ktest_clear");
-    if (!ktest_clear) {
-        err = -ENOMEM;
-        goto fail_startup;
+    if (softirq_gets && conn_ops->cacheobj_conntable_try_get) {
+        timer_setup(&g_softirq_timer, _softirq_get_and_put_entry, 0);
+        mod_timer(&g_softirq_timer, jiffies + 1);
+        g_softirq_started = true;
+    }
+
+    if (nr_mix_threads) {
+        ktest_mix = spawn_test_threads(threadfn_test_mix, (void*)g_conntable,
+                nr_mix_threads, "ktest_mix");
+        if (!ktest_mix) {
+            err = -ENOMEM;
+            goto fail_startup;
+        }
+    }
+
+    if (nr_dump_threads) {
+        ktest_dump = spawn_test_threads(threadfn_test_dump, (void*)g_conntable,
+                nr_dump_threads, "ktest_dump");
+        if (!ktest_dump) {
+            err = -ENOMEM;
+            goto fail_startup;
+        }
+    }
+
+    if (nr_cleanup_threads) {
+        ktest_clear = spawn_test_threads(threadfn_test_clear,
+                (void*)g_conntable, nr_cleanup_threads, "ktest_clear");
+        if (!ktest_clear) {
+            err = -ENOMEM;
+            goto fail_startup;
+        }
     }
-#endif
 
     // setup proc for stats
     if (!proc_mkdir(PROCFS_CONNTABLE_TESTDIR, NULL) ||
@@ -425,6 +1785,37 @@ static int __init start_module(void)
         err = -ENOMEM;
         goto fail_startup;
     }
+    if (conn_ops->cacheobj_conntable_pressure_dump &&
+        !proc_create(PROCFS_PRESSURE_TEST_PATH, 0, NULL, &pressure_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    if (conn_ops->cacheobj_conntable_trace_dump &&
+        !proc_create(PROCFS_TRACE_TEST_PATH, 0, NULL, &trace_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    if (conn_ops->cacheobj_conntable_outlier_dump &&
+        !proc_create(PROCFS_OUTLIER_TEST_PATH, 0, NULL, &outlier_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    if (conn_ops->cacheobj_conntable_bucket_dump &&
+        !proc_create(PROCFS_BUCKET_TEST_PATH, 0, NULL, &bucket_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    if (conn_ops->cacheobj_conntable_topk_dump &&
+        !proc_create(PROCFS_TOPK_TEST_PATH, 0, NULL, &topk_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
+    if (!proc_create(PROCFS_THROUGHPUT_TEST_PATH, 0, NULL,
+        &throughput_proc_fops) ||
+        !proc_create(PROCFS_WORKLOAD_TEST_PATH, 0, NULL, &workload_proc_fops)) {
+        err = -ENOMEM;
+        goto fail_startup;
+    }
     return 0;
 
 fail_startup:
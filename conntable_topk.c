@@ -0,0 +1,186 @@
+/* Connection table heavy hitters
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+
+#include "conntable_topk.h"
+#include "stat.h"
+
+#define TOPK_COUNTERS (NR_TOPK_METRICS * TOPK_DEPTH * TOPK_WIDTH)
+
+int conntable_topk_init(struct conntable_topk *tk)
+{
+    tk->sketch = kvcalloc(TOPK_COUNTERS, sizeof(atomic64_t), GFP_KERNEL);
+    if (!tk->sketch)
+        return -ENOMEM;
+    tk->nr_events = alloc_percpu(unsigned long);
+    if (!tk->nr_events) {
+        kvfree(tk->sketch);
+        tk->sketch = NULL;
+        return -ENOMEM;
+    }
+    get_random_bytes(tk->seeds, sizeof(tk->seeds));
+    spin_lock_init(&tk->lock);
+    tk->next_decay = jiffies + TOPK_DECAY_SECS * HZ;
+    memset(tk->top, 0, sizeof(tk->top));
+    return 0;
+}
+
+void conntable_topk_exit(struct conntable_topk *tk)
+{
+    free_percpu(tk->nr_events);
+    tk->nr_events = NULL;
+    kvfree(tk->sketch);
+    tk->sketch = NULL;
+}
+
+static inline atomic64_t *__topk_counter(struct conntable_topk *tk,
+    topk_metric_t metric, unsigned int row, u32 key)
+{
+    return &tk->sketch[(metric * TOPK_DEPTH + row) * TOPK_WIDTH +
+        (jhash_1word(key, tk->seeds[row]) & (TOPK_WIDTH - 1))];
+}
+
+/*
+ * start a decay once per period: advance next_decay and halve the top
+ * list, returning the shift the sketch is owed, 0 if none is due.
+ * note: caller must have topk lock
+ */
+static unsigned int __topk_decay_top(struct conntable_topk *tk)
+{
+    unsigned int i, j, shift;
+
+    if (time_before(jiffies, tk->next_decay))
+        return 0;
+    shift = min_t(unsigned long, 63,
+        (jiffies - tk->next_decay) / (TOPK_DECAY_SECS * HZ) + 1);
+    tk->next_decay += shift * TOPK_DECAY_SECS * HZ;
+    if (time_before_eq(tk->next_decay, jiffies))
+        tk->next_decay = jiffies + TOPK_DECAY_SECS * HZ;
+
+    for (i = 0; i < NR_TOPK_METRICS; i++) {
+        for (j = 0; j < TOPK_NR; j++)
+            tk->top[i][j].count >>= shift;
+    }
+    return shift;
+}
+
+/*
+ * halve the sketch by the shift its caller took from __topk_decay_top.
+ * run outside the topk lock, so the sweep does not hold up the adds. an
+ * add racing with the halving of its counter may be lost, which the
+ * estimate can afford.
+ */
+static void __topk_decay_sketch(struct conntable_topk *tk, unsigned int shift)
+{
+    unsigned int i;
+    s64 count;
+
+    if (!shift)
+        return;
+    for (i = 0; i < TOPK_COUNTERS; i++) {
+        count = atomic64_read(&tk->sketch[i]);
+        if (count)
+            atomic64_set(&tk->sketch[i], count >> shift);
+    }
+}
+
+/*
+ * count val of a sampled event against the pool, and let the pool into
+ * the top list once its estimate beats the smallest kept
+ */
+void __conntable_topk_add(struct conntable_topk *tk, topk_metric_t metric,
+    u32 key, const char *ip, unsigned int port, u64 val)
+{
+    unsigned int row, i, min = 0, shift;
+    u64 est = U64_MAX;
+    struct conntable_topk_entry *top = tk->top[metric];
+
+    if (!tk->sketch)
+        return;
+
+    val *= TOPK_SAMPLE_RATE;
+    for (row = 0; row < TOPK_DEPTH; row++)
+        est = min_t(u64, est, atomic64_add_return(val,
+            __topk_counter(tk, metric, row, key)));
+
+    // bh off, as gets may come from softirq
+    if (!spin_trylock_bh(&tk->lock))
+        return;
+    shift = __topk_decay_top(tk);
+    for (i = 0; i < TOPK_NR; i++) {
+        if (top[i].count && (top[i].key == key) && (top[i].port == port) &&
+            (strcmp(top[i].ip, ip) == 0))
+            break;
+        if (top[i].count < top[min].count)
+            min = i;
+    }
+    if (i < TOPK_NR) {
+        top[i].count = est;
+    } else if (est > top[min].count) {
+        top[min].key = key;
+        top[min].port = port;
+        top[min].count = est;
+        strscpy(top[min].ip, ip, sizeof(top[min].ip));
+    }
+    spin_unlock_bh(&tk->lock);
+    __topk_decay_sketch(tk, shift);
+}
+
+static int __topk_cmp(const void *a, const void *b)
+{
+    const struct conntable_topk_entry *ea = a, *eb = b;
+
+    if (ea->count == eb->count)
+        return 0;
+    return (ea->count < eb->count) ? 1 : -1;
+}
+
+/*
+ * top pools of each metric, hottest first. a count built up over the
+ * current decay period plus the halved ones before approaches
+ * rate * (period + elapsed), which gives the rate.
+ */
+void conntable_topk_dump(struct conntable_topk *tk, struct seq_file *m)
+{
+    static const char * const names[NR_TOPK_METRICS] = {
+        [TOPK_GETS] = "GETS/s",
+        [TOPK_WAIT_NS] = "WAIT(ns)/s",
+        [TOPK_BYTES] = "BYTES/s",
+    };
+    unsigned int metric, i, shift;
+    unsigned long window;
+    struct conntable_topk_entry top[TOPK_NR];
+
+    if (!tk->sketch)
+        return;
+
+    seq_printf(m, "topk pools :%u sampled 1/%u decay(s) :%u\n", TOPK_NR,
+            TOPK_SAMPLE_RATE, TOPK_DECAY_SECS);
+
+    for (metric = 0; metric < NR_TOPK_METRICS; metric++) {
+        spin_lock_bh(&tk->lock);
+        shift = __topk_decay_top(tk);
+        memcpy(top, tk->top[metric], sizeof(top));
+        // jiffies of the period gone, plus a whole period
+        window = 2 * TOPK_DECAY_SECS * HZ - (tk->next_decay - jiffies);
+        spin_unlock_bh(&tk->lock);
+        __topk_decay_sketch(tk, shift);
+
+        sort(top, TOPK_NR, sizeof(top[0]), __topk_cmp, NULL);
+        seq_printf(m, "\nPOOL\t%s\n", names[metric]);
+        for (i = 0; (i < TOPK_NR) && top[i].count; i++)
+            seq_printf(m, "%s:%u\t%lu\n", top[i].ip, top[i].port,
+                    div64_safe(top[i].count * HZ, window));
+    }
+}
@@ -0,0 +1,73 @@
+/* Connection table heavy hitters
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#ifndef __CONNTABLE_TOPK_H
+#define __CONNTABLE_TOPK_H
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/inet.h>
+#include <linux/seq_file.h>
+
+/* pools kept per metric */
+#define TOPK_NR 8
+
+/* count-min sketch rows, and counters per row (power of 2) */
+#define TOPK_DEPTH 4
+#define TOPK_WIDTH 512
+
+/* one in TOPK_SAMPLE_RATE events of a cpu is counted, with that weight */
+#define TOPK_SAMPLE_RATE 16
+
+/* counts halve every TOPK_DECAY_SECS, so they follow the current load */
+#define TOPK_DECAY_SECS 1
+
+typedef enum topk_metric {
+    TOPK_GETS = 0,
+    TOPK_WAIT_NS, // get wait
+    TOPK_BYTES,   // tx + rx accounted
+    NR_TOPK_METRICS
+}topk_metric_t;
+
+struct conntable_topk_entry {
+    u32                 key; // pool bucket key
+    unsigned int        port;
+    u64                 count; // decayed sketch estimate, 0 for free
+    char                ip[INET_ADDRSTRLEN];
+};
+
+/*
+ * heavy hitters over pools. a count-min sketch per metric estimates the
+ * decayed count of any pool, the TOPK_NR pools of highest estimate are
+ * kept beside it. updates are sampled, and leave the top list alone if
+ * another cpu is updating it.
+ */
+struct conntable_topk {
+    atomic64_t          *sketch; // [metric][row][TOPK_WIDTH]
+    u32                 seeds[TOPK_DEPTH]; // row hashes
+    unsigned long __percpu *nr_events; // sampling clock
+    spinlock_t          lock; // protects top and next_decay, bh safe
+    unsigned long       next_decay; // jiffies
+    struct conntable_topk_entry top[NR_TOPK_METRICS][TOPK_NR];
+};
+
+int conntable_topk_init(struct conntable_topk *tk);
+void conntable_topk_exit(struct conntable_topk *tk);
+void __conntable_topk_add(struct conntable_topk *tk, topk_metric_t metric,
+    u32 key, const char *ip, unsigned int port, u64 val);
+void conntable_topk_dump(struct conntable_topk *tk, struct seq_file *m);
+
+/* true for the one sampled event in TOPK_SAMPLE_RATE of this cpu */
+static inline bool conntable_topk_sample(struct conntable_topk *tk)
+{
+    return tk->nr_events &&
+        !(this_cpu_inc_return(*tk->nr_events) % TOPK_SAMPLE_RATE);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/* Connection table topology blob
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/errno.h>
+
+#include "conntable_topo.h"
+
+/*
+ * check header and records of a blob before any is read
+ * returns 0, or -EINVAL on a malformed blob
+ */
+int conntable_topo_check(const void *blob, size_t len)
+{
+    unsigned int i, nr_nodes;
+    size_t hdr_len, node_len;
+    __be32 addr;
+    const struct conntable_topo_hdr *hdr = blob;
+    const struct conntable_topo_node *node;
+
+    if (!blob || (len < sizeof(*hdr)) ||
+        (le32_to_cpu(hdr->magic) != CONNTABLE_TOPO_MAGIC) ||
+        !le16_to_cpu(hdr->version)) {
+        pr_err("conntable topology bad header\n");
+        return -EINVAL;
+    }
+
+    hdr_len = le16_to_cpu(hdr->hdr_len);
+    node_len = le32_to_cpu(hdr->node_len);
+    nr_nodes = le32_to_cpu(hdr->nr_nodes);
+    if ((hdr_len < sizeof(*hdr)) || (node_len < sizeof(*node)) ||
+        (nr_nodes > CONNTABLE_TOPO_MAX_NODES) ||
+        (hdr_len + (u64)nr_nodes * node_len > len)) {
+        pr_err("conntable topology truncated, nodes :%u len :%zu\n",
+            nr_nodes, len);
+        return -EINVAL;
+    }
+
+    for (i = 0; i < nr_nodes; i++) {
+        node = conntable_topo_node(blob, i);
+        if (!le16_to_cpu(node->port) ||
+            (le32_to_cpu(node->nr_conns) > CONNTABLE_TOPO_MAX_CONNS)) {
+            addr = node->addr;
+            pr_err("conntable topology bad node %u <%pI4:%u>\n", i, &addr,
+                le16_to_cpu(node->port));
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+/* bytes of a snapshot of nr_nodes pools */
+size_t conntable_topo_snap_len(unsigned int nr_nodes)
+{
+    return sizeof(struct conntable_topo_hdr) +
+        (size_t)nr_nodes * sizeof(struct conntable_topo_snap_node);
+}
+
+/* header of a snapshot blob of conntable_topo_snap_len(nr_nodes) bytes */
+void conntable_topo_snap_init(void *blob, unsigned int nr_nodes)
+{
+    struct conntable_topo_hdr *hdr = blob;
+
+    hdr->magic = cpu_to_le32(CONNTABLE_TOPO_MAGIC);
+    hdr->version = cpu_to_le16(CONNTABLE_TOPO_VERSION);
+    hdr->hdr_len = cpu_to_le16(sizeof(*hdr));
+    hdr->nr_nodes = cpu_to_le32(nr_nodes);
+    hdr->node_len = cpu_to_le32(sizeof(struct conntable_topo_snap_node));
+}
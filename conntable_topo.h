@@ -0,0 +1,112 @@
+/* Connection table topology blob
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#ifndef __CONNTABLE_TOPO_H
+#define __CONNTABLE_TOPO_H
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+
+#define CONNTABLE_TOPO_MAGIC 0x504f5443 // "CTOP"
+#define CONNTABLE_TOPO_VERSION 2 // 2: pool counters, for snapshots
+
+/* nodes of a blob, bounds the memory a bad blob makes us allocate */
+#define CONNTABLE_TOPO_MAX_NODES (1U << 20)
+#define CONNTABLE_TOPO_MAX_CONNS 4096 // per node
+
+/*
+ * packed topology, little endian but the address: a header, then nr_nodes
+ * records of node_len bytes from hdr_len on. newer versions may grow
+ * header and records, readers skip what they do not know.
+ */
+struct conntable_topo_hdr {
+    __le32              magic;
+    __le16              version;
+    __le16              hdr_len;
+    __le32              nr_nodes;
+    __le32              node_len;
+} __packed;
+
+struct conntable_topo_node {
+    __be32              addr; // ipv4, network order
+    __le16              port;
+    __le16              flags; // none yet, 0
+    __le32              nr_conns;
+    __le64              ops_per_sec;   // pool rate limits, 0 for unlimited
+    __le64              bytes_per_sec;
+} __packed;
+
+/*
+ * counters of a pool, and sums over its connections, a snapshot records
+ * after each node from version 2 on. node_len tells whether they are there.
+ */
+typedef enum conntable_topo_stat {
+    TOPO_STAT_SLOW_PATHS = 0,
+    TOPO_STAT_AFFINITY_HITS,
+    TOPO_STAT_AFFINITY_MISSES,
+    TOPO_STAT_HANDOFFS,
+    TOPO_STAT_WAKEUPS,
+    TOPO_STAT_WAKE_NS,
+    TOPO_STAT_LEASE_EXPIRED,
+    TOPO_STAT_LEASE_RECYCLED,
+    TOPO_STAT_STALE_PUTS,
+    TOPO_STAT_HEDGES,
+    TOPO_STAT_HEDGE_WINS,
+    TOPO_STAT_THROTTLED_GETS,
+    TOPO_STAT_THROTTLED_BYTES,
+    TOPO_STAT_TRY_MISSES,
+    TOPO_STAT_LOOKUPS, // connection sums from here on
+    TOPO_STAT_GET_NS,
+    TOPO_STAT_PUT_NS,
+    TOPO_STAT_WAIT_NS,
+    TOPO_STAT_TX_BYTES,
+    TOPO_STAT_RX_BYTES,
+    NR_TOPO_STATS
+}conntable_topo_stat_t;
+
+struct conntable_topo_node_stats {
+    __le64              stat[NR_TOPO_STATS];
+} __packed;
+
+/* record of a snapshot, node then its counters */
+struct conntable_topo_snap_node {
+    struct conntable_topo_node node;
+    struct conntable_topo_node_stats stats;
+} __packed;
+
+int conntable_topo_check(const void *blob, size_t len);
+size_t conntable_topo_snap_len(unsigned int nr_nodes);
+void conntable_topo_snap_init(void *blob, unsigned int nr_nodes);
+
+/* i-th node record, of a blob which passed conntable_topo_check */
+static inline const struct conntable_topo_node *conntable_topo_node
+    (const void *blob, unsigned int i)
+{
+    const struct conntable_topo_hdr *hdr = blob;
+
+    return blob + le16_to_cpu(hdr->hdr_len) +
+        (size_t)i * le32_to_cpu(hdr->node_len);
+}
+
+/* counters of the i-th node, NULL if its records have none */
+static inline const struct conntable_topo_node_stats *conntable_topo_stats
+    (const void *blob, unsigned int i)
+{
+    const struct conntable_topo_hdr *hdr = blob;
+
+    if (le32_to_cpu(hdr->node_len) < sizeof(struct conntable_topo_snap_node))
+        return NULL;
+    return (const void *)conntable_topo_node(blob, i) +
+        sizeof(struct conntable_topo_node);
+}
+
+static inline unsigned int conntable_topo_nr_nodes(const void *blob)
+{
+    return le32_to_cpu(((const struct conntable_topo_hdr *)blob)->nr_nodes);
+}
+
+#endif
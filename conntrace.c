@@ -0,0 +1,205 @@
+/* Connection table flight recorder
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/stacktrace.h>
+
+#include "conntable.h"
+#include "conntrace.h"
+
+static const char * const conntrace_op_names[NR_TRACE_OPS] = {
+    [TRACE_GET] = "get",
+    [TRACE_PUT] = "put",
+    [TRACE_INSERT] = "insert",
+    [TRACE_REMOVE] = "remove",
+};
+
+#define TRACE_FMT "cpu %d ts %llu %s <%s:%u> conn %p %s->%s wait(ns) %llu " \
+    "hold(ns) %llu\n"
+#define TRACE_ARGS(cpu, ev) cpu, ev->ts_ns, conntrace_op_names[ev->op], \
+    ev->ip, ev->port, ev->conn, conn_state_status(ev->from), \
+    conn_state_status(ev->to), ev->wait_ns, ev->hold_ns
+
+static void conntrace_dump_work(struct work_struct *work)
+{
+    struct conntrace *trace = container_of(work, struct conntrace,
+            dump_work);
+
+    pr_info("conntrace: event over %llu ns, dumping flight recorder\n",
+        trace->threshold_ns);
+    conntrace_dump(trace, NULL);
+    atomic_set(&trace->frozen, 0);
+}
+
+int conntrace_init(struct conntrace *trace, u64 threshold_ns, u64 outlier_ns)
+{
+    trace->bufs = alloc_percpu(struct conntrace_buf);
+    if (!trace->bufs)
+        return -ENOMEM;
+    trace->outliers = kcalloc(CONNTRACE_OUTLIERS,
+        sizeof(struct conntrace_outlier), GFP_KERNEL);
+    if (!trace->outliers) {
+        free_percpu(trace->bufs);
+        trace->bufs = NULL;
+        return -ENOMEM;
+    }
+    trace->threshold_ns = threshold_ns;
+    atomic_set(&trace->frozen, 0);
+    trace->next_trigger = jiffies;
+    INIT_WORK(&trace->dump_work, conntrace_dump_work);
+    trace->outlier_ns = outlier_ns;
+    spin_lock_init(&trace->outlier_lock);
+    trace->nr_outliers = 0;
+    atomic_long_set(&trace->nr_outliers_dropped, 0);
+    ratelimit_state_init(&trace->outlier_rs, HZ, CONNTRACE_OUTLIER_BURST);
+    return 0;
+}
+
+void conntrace_exit(struct conntrace *trace)
+{
+    if (!trace->bufs)
+        return;
+    cancel_work_sync(&trace->dump_work);
+    free_percpu(trace->bufs);
+    trace->bufs = NULL;
+    kfree(trace->outliers);
+    trace->outliers = NULL;
+}
+
+/*
+ * freeze recording and dump rings to the kernel log, at most once every
+ * CONNTRACE_TRIGGER_INTERVAL seconds
+ */
+void conntrace_trigger(struct conntrace *trace)
+{
+    unsigned long next = READ_ONCE(trace->next_trigger);
+
+    if (time_before(jiffies, next) ||
+        (cmpxchg(&trace->next_trigger, next,
+            jiffies + CONNTRACE_TRIGGER_INTERVAL * HZ) != next))
+        return;
+    if (atomic_cmpxchg(&trace->frozen, 0, 1) == 0)
+        schedule_work(&trace->dump_work);
+}
+
+/*
+ * dump events of each cpu oldest first, to seq file or kernel log if NULL
+ */
+void conntrace_dump(struct conntrace *trace, struct seq_file *m)
+{
+    int cpu;
+    unsigned long head, i;
+    struct conntrace_buf *buf;
+    struct conntrace_event *ev;
+
+    if (!trace->bufs)
+        return;
+
+    for_each_possible_cpu(cpu) {
+        buf = per_cpu_ptr(trace->bufs, cpu);
+        head = READ_ONCE(buf->head);
+        i = (head > CONNTRACE_EVENTS) ? head - CONNTRACE_EVENTS : 0;
+        for (; i < head; i++) {
+            ev = &buf->ev[i & (CONNTRACE_EVENTS - 1)];
+            if (m)
+                seq_printf(m, TRACE_FMT, TRACE_ARGS(cpu, ev));
+            else
+                pr_info(TRACE_FMT, TRACE_ARGS(cpu, ev));
+        }
+    }
+}
+
+/*
+ * rate limit slow operation capture, so a latency storm cannot turn the
+ * capture into load. returns true if caller may capture.
+ */
+bool conntrace_outlier_allowed(struct conntrace *trace)
+{
+    if (!trace->outliers)
+        return false;
+    if (__ratelimit(&trace->outlier_rs))
+        return true;
+    atomic_long_inc(&trace->nr_outliers_dropped);
+    return false;
+}
+
+/*
+ * capture a slow operation with the stack of its caller, replacing the
+ * oldest capture once full
+ */
+void conntrace_outlier(struct conntrace *trace, conntrace_op_t op,
+    const char *ip, unsigned int port, u64 latency_ns,
+    const struct conntrace_pool_state *pool)
+{
+    unsigned long flags;
+    struct conntrace_outlier *o, tmp;
+
+    tmp.ts_ns = local_clock();
+    tmp.latency_ns = latency_ns;
+    memcpy(tmp.ip, ip, INET_ADDRSTRLEN);
+    tmp.port = port;
+    tmp.op = op;
+    tmp.cpu = raw_smp_processor_id();
+    tmp.pid = task_pid_nr(current);
+    memcpy(tmp.comm, current->comm, TASK_COMM_LEN);
+    tmp.pool = *pool;
+#ifdef CONFIG_STACKTRACE
+    // skip ourselves and the backend helper
+    tmp.nr_entries = stack_trace_save(tmp.entries, CONNTRACE_STACK_DEPTH, 2);
+#else
+    tmp.nr_entries = 0;
+#endif
+
+    spin_lock_irqsave(&trace->outlier_lock, flags);
+    o = &trace->outliers[trace->nr_outliers++ % CONNTRACE_OUTLIERS];
+    *o = tmp;
+    spin_unlock_irqrestore(&trace->outlier_lock, flags);
+}
+
+/*
+ * dump captured slow operations oldest first
+ */
+void conntrace_outlier_dump(struct conntrace *trace, struct seq_file *m)
+{
+    unsigned long flags, i, nr;
+    unsigned int j;
+    struct conntrace_outlier *o;
+
+    if (!trace->outliers)
+        return;
+
+    o = kmalloc(sizeof(*o), GFP_KERNEL);
+    if (!o)
+        return;
+
+    seq_printf(m, "outlier threshold(ns) :%llu captured :%lu dropped :%ld\n",
+            trace->outlier_ns, READ_ONCE(trace->nr_outliers),
+            atomic_long_read(&trace->nr_outliers_dropped));
+
+    nr = READ_ONCE(trace->nr_outliers);
+    i = (nr > CONNTRACE_OUTLIERS) ? nr - CONNTRACE_OUTLIERS : 0;
+    for (; i < nr; i++) {
+        // copy out, so printing does not hold off capture
+        spin_lock_irqsave(&trace->outlier_lock, flags);
+        *o = trace->outliers[i % CONNTRACE_OUTLIERS];
+        spin_unlock_irqrestore(&trace->outlier_lock, flags);
+
+        seq_printf(m, "\nts %llu %s <%s:%u> latency(ns) %llu cpu %d %.*s/%d\n",
+                o->ts_ns, conntrace_op_names[o->op], o->ip, o->port,
+                o->latency_ns, o->cpu, TASK_COMM_LEN, o->comm, o->pid);
+        seq_printf(m, "pool ready :%u active :%u failed :%u scanned :%u "
+                "waiters :%u slow_paths :%llu\n", o->pool.nr_ready,
+                o->pool.nr_active, o->pool.nr_failed, o->pool.nr_scanned,
+                o->pool.nr_waiters, o->pool.slow_paths);
+        for (j = 0; j < o->nr_entries; j++)
+            seq_printf(m, " %pS\n", (void *)o->entries[j]);
+    }
+    kfree(o);
+}
@@ -0,0 +1,145 @@
+/* Connection table flight recorder
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public Licence
+ * as published by the Free Software Foundation; either version
+ * 2 of the Licence, or (at your option) any later version.
+ */
+#ifndef __CONNTRACE_H
+#define __CONNTRACE_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+#include <linux/inet.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/ratelimit.h>
+#include <linux/sched.h>
+
+/* events kept per cpu, power of 2 */
+#define CONNTRACE_EVENTS 128
+
+/* seconds between automatic dumps */
+#define CONNTRACE_TRIGGER_INTERVAL 10
+
+/* slow operations kept, and at most captured per second */
+#define CONNTRACE_OUTLIERS 32
+#define CONNTRACE_OUTLIER_BURST 10
+#define CONNTRACE_STACK_DEPTH 16
+
+typedef enum conntrace_op {
+    TRACE_GET = 0,
+    TRACE_PUT,
+    TRACE_INSERT,
+    TRACE_REMOVE,
+    NR_TRACE_OPS
+}conntrace_op_t;
+
+struct conntrace_event {
+    u64                 ts_ns; // local_clock
+    u64                 wait_ns;
+    u64                 hold_ns;
+    const void          *conn;
+    char                ip[INET_ADDRSTRLEN];
+    unsigned int        port;
+    u8                  op;
+    u8                  from; // connection state transition
+    u8                  to;
+};
+
+/* pool as seen by a slow operation */
+struct conntrace_pool_state {
+    unsigned int        nr_ready;
+    unsigned int        nr_active;
+    unsigned int        nr_failed;
+    unsigned int        nr_scanned; // connections counted, list scan is capped
+    unsigned int        nr_waiters;
+    u64                 slow_paths; // pool slow paths during the operation
+};
+
+struct conntrace_outlier {
+    u64                 ts_ns;
+    u64                 latency_ns;
+    char                ip[INET_ADDRSTRLEN];
+    unsigned int        port;
+    u8                  op;
+    int                 cpu;
+    int                 pid;
+    char                comm[TASK_COMM_LEN];
+    struct conntrace_pool_state pool;
+    unsigned int        nr_entries;
+    unsigned long       entries[CONNTRACE_STACK_DEPTH];
+};
+
+struct conntrace_buf {
+    unsigned long       head; // events recorded on this cpu
+    struct conntrace_event ev[CONNTRACE_EVENTS];
+};
+
+/*
+ * per cpu rings of the last CONNTRACE_EVENTS events. an event waiting or
+ * holding longer than threshold_ns freezes all rings and dumps them to the
+ * kernel log from a work item, recording resumes after the dump.
+ */
+struct conntrace {
+    struct conntrace_buf __percpu *bufs;
+    u64                 threshold_ns; // 0 for no automatic dumps
+    atomic_t            frozen;
+    unsigned long       next_trigger; // jiffies
+    struct work_struct  dump_work;
+    // slow operation capture
+    u64                 outlier_ns; // 0 for none
+    spinlock_t          outlier_lock; // protects outliers and nr_outliers
+    struct conntrace_outlier *outliers; // last CONNTRACE_OUTLIERS
+    unsigned long       nr_outliers;
+    atomic_long_t       nr_outliers_dropped; // by rate limit
+    struct ratelimit_state outlier_rs;
+};
+
+int conntrace_init(struct conntrace *trace, u64 threshold_ns, u64 outlier_ns);
+void conntrace_exit(struct conntrace *trace);
+void conntrace_trigger(struct conntrace *trace);
+void conntrace_dump(struct conntrace *trace, struct seq_file *m);
+bool conntrace_outlier_allowed(struct conntrace *trace);
+void conntrace_outlier(struct conntrace *trace, conntrace_op_t op,
+    const char *ip, unsigned int port, u64 latency_ns,
+    const struct conntrace_pool_state *pool);
+void conntrace_outlier_dump(struct conntrace *trace, struct seq_file *m);
+
+/*
+ * record an event on this cpu, safe in any context. an interrupting event
+ * takes the next slot, a reader may see a slot being filled.
+ */
+static inline void conntrace_record(struct conntrace *trace,
+    conntrace_op_t op, const char *ip, unsigned int port, const void *conn,
+    int from, int to, u64 wait_ns, u64 hold_ns)
+{
+    struct conntrace_buf *buf;
+    struct conntrace_event *ev;
+
+    if (!trace->bufs || atomic_read(&trace->frozen))
+        return;
+
+    buf = get_cpu_ptr(trace->bufs);
+    ev = &buf->ev[(this_cpu_inc_return(trace->bufs->head) - 1) &
+        (CONNTRACE_EVENTS - 1)];
+    ev->ts_ns = local_clock();
+    ev->wait_ns = wait_ns;
+    ev->hold_ns = hold_ns;
+    ev->conn = conn;
+    memcpy(ev->ip, ip, INET_ADDRSTRLEN);
+    ev->port = port;
+    ev->op = op;
+    ev->from = from;
+    ev->to = to;
+    put_cpu_ptr(trace->bufs);
+
+    if (trace->threshold_ns &&
+        ((wait_ns > trace->threshold_ns) || (hold_ns > trace->threshold_ns)))
+        conntrace_trigger(trace);
+}
+
+#endif
@@ -10,6 +10,9 @@
 #define __STAT_H
 
 #include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
 
 static inline unsigned long div64_safe(unsigned long sum, unsigned long nr)
 {
@@ -26,6 +29,13 @@ static inline s64 ktime_ns_delta(const ktime_t later, const ktime_t earlier)
     return ktime_to_ns(ktime_sub(later, earlier));
 }
 
+#define CACHEOBJS_HIST_BUCKETS 40
+
+/* log2 histogram, bucket i counts values in [2^(i-1), 2^i) */
+struct cacheobjects_hist {
+	atomic64_t bucket[CACHEOBJS_HIST_BUCKETS];
+};
+
 #ifdef CONFIG_CACHEOBJS_STATS
 
 static inline void cacheobjects_stat(atomic_t *stat)
@@ -78,6 +88,42 @@ static inline void cacheobjects_stat64_ktime(ktime_t *now)
         *now = ktime_get();
 }
 
+static inline void cacheobjects_hist_reset(struct cacheobjects_hist *hist)
+{
+	int i;
+
+	for (i = 0; i < CACHEOBJS_HIST_BUCKETS; i++)
+		atomic64_set(&hist->bucket[i], 0);
+}
+
+static inline void cacheobjects_hist_add(struct cacheobjects_hist *hist,
+	u64 value)
+{
+	atomic64_inc(&hist->bucket[min(fls64(value),
+		CACHEOBJS_HIST_BUCKETS - 1)]);
+}
+
+/* upper bound of the bucket holding the pct percentile, 0 if empty */
+static inline u64 cacheobjects_hist_percentile(struct cacheobjects_hist *hist,
+	unsigned int pct)
+{
+	int i;
+	u64 total = 0, sum = 0, target;
+
+	for (i = 0; i < CACHEOBJS_HIST_BUCKETS; i++)
+		total += atomic64_read(&hist->bucket[i]);
+	if (!total)
+		return 0;
+
+	target = div64_u64(total * pct + 99, 100);
+	for (i = 0; i < CACHEOBJS_HIST_BUCKETS; i++) {
+		sum += atomic64_read(&hist->bucket[i]);
+		if (sum >= target)
+			break;
+	}
+	return 1ULL << min(i, CACHEOBJS_HIST_BUCKETS - 1);
+}
+
 #define INITIALIZE_STATS_CONFIG(value, newvalue) \
  (value) = (newvalue)
 
@@ -92,6 +138,9 @@ static inline void cacheobjects_stat64_ktime(ktime_t *now)
 #define cacheobjects_stat64_jiffies(stat) do {} while (0)
 #define cacheobjects_stat64_jiffies2usec(stat) 0
 #define cacheobjects_stat64_ktime(stat) do {} while (0)
+#define cacheobjects_hist_reset(hist) do {} while (0)
+#define cacheobjects_hist_add(hist, value) do {} while (0)
+#define cacheobjects_hist_percentile(hist, pct) 0
 #define INITIALIZE_STATS_CONFIG(value, newvalue) do {} while (0)
 
 #endif
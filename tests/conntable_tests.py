@@ -5,6 +5,8 @@
 import os
 import time
 import random
+import socket
+import struct
 import unittest
 import subprocess
 from time import sleep
@@ -15,6 +17,17 @@ TESTTIME=15
 BASE_THREADS=8
 MAX_THREADS=12
 
+FIRMWAREDIR='/lib/firmware'
+
+def WriteTopology(path, nr_nodes, nr_conns):
+    ''' Writes a topology blob of nr_nodes local targets '''
+
+    with open(path, 'wb') as f:
+	f.write(struct.pack('<IHHII', 0x504f5443, 1, 16, nr_nodes, 32))
+	for port in range(1, nr_nodes + 1):
+		f.write(struct.pack('<4sHHIQQ', socket.inet_aton('127.0.0.1'),
+			port, 0, nr_conns, 0, 0))
+
 def RunCommand(cmd, strict = True):
     ''' Executes a bash command '''
 
@@ -50,13 +63,41 @@ class ConntableUnitTests(unittest.TestCase):
 	cmd = 'cat /proc/fs/cacheobjs_test/conntable >> {}'. \
 		format(filename)
 	RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/pressure'):
+		cmd = 'cat /proc/fs/cacheobjs_test/pressure >> {}'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/trace'):
+		cmd = 'cat /proc/fs/cacheobjs_test/trace > {}-trace'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/throughput'):
+		cmd = 'cat /proc/fs/cacheobjs_test/throughput >> {}'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/workload'):
+		cmd = 'cat /proc/fs/cacheobjs_test/workload >> {}'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/outliers'):
+		cmd = 'cat /proc/fs/cacheobjs_test/outliers > {}-outliers'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/buckets'):
+		cmd = 'cat /proc/fs/cacheobjs_test/buckets > {}-buckets'. \
+			format(filename)
+		RunCommand(cmd)
+	if os.path.exists('/proc/fs/cacheobjs_test/topk'):
+		cmd = 'cat /proc/fs/cacheobjs_test/topk > {}-topk'. \
+			format(filename)
+		RunCommand(cmd)
 
     def runTest(self, test_id, nr_nodes, nr_conns, nr_insert_threads, \
-                nr_lookup_threads, put_delay_us=0):
+                nr_lookup_threads, put_delay_us=0, params=''):
 	cmd = 'insmod {} nr_nodes={} nr_conns={} nr_insert_threads={} '\
-                'nr_lookup_threads={} put_delay_us={}'.format(TESTMODULE, \
+                'nr_lookup_threads={} put_delay_us={} {}'.format(TESTMODULE, \
                 nr_nodes, nr_conns, nr_insert_threads, nr_lookup_threads, \
-                put_delay_us)
+                put_delay_us, params)
         rc = RunCommand(cmd)
         self.assertEqual(rc, 0)
 	sleep (TESTTIME)
@@ -134,6 +175,118 @@ class ConntableUnitTests(unittest.TestCase):
 	self.runTest('test_008', nr_nodes=1, nr_conns=BASE_THREADS, nr_insert_threads=1,
                         nr_lookup_threads=MAX_THREADS, put_delay_us=2000)
 
+    #@unittest.skip('skip test')
+    def test_009(self):
+        """
+            scaling sweep over thread placements, smt siblings of a core,
+            one socket and across sockets, compare gets/s of each run to
+            expose cross socket cost of the table lock and pool semaphore
+        """
+	for i, placement in enumerate(['none', 'smt', 'socket', 'cross']):
+		if i:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_009-{}'.format(placement), nr_nodes=1,
+			nr_conns=BASE_THREADS, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS,
+			params='placement={}'.format(placement))
+
+    #@unittest.skip('skip test')
+    def test_010(self):
+        """
+            churn plus lookup, connections inserted and removed while
+            being got and put, with a stats dump thread
+        """
+	self.runTest('test_010', nr_nodes=BASE_THREADS, nr_conns=BASE_THREADS,
+			nr_insert_threads=1, nr_lookup_threads=BASE_THREADS,
+			params='nr_mix_threads={} mix_insert=10 mix_remove=10 '
+			'mix_getput=80 nr_dump_threads=1'.format(BASE_THREADS))
+
+    #@unittest.skip('skip test')
+    def test_011(self):
+        """
+            get/put through the ops table and through static calls,
+            compare gets/s of the two runs with mitigations on
+        """
+	for static_calls in [0, 1]:
+		if static_calls:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_011-{}'.format(static_calls), nr_nodes=1,
+			nr_conns=BASE_THREADS, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS,
+			params='static_calls={}'.format(static_calls))
+
+    #@unittest.skip('skip test')
+    def test_012(self):
+        """
+            key hash sweep over many ports of one host, compare the bucket
+            chains and probes per lookup of each run
+        """
+	for i, key_hash in enumerate(['jhash', 'hsiphash', 'mult']):
+		if i:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_012-{}'.format(key_hash),
+			nr_nodes=BASE_THREADS * 64, nr_conns=1, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS,
+			params='key_hash={}'.format(key_hash))
+
+    #@unittest.skip('skip test')
+    def test_013(self):
+        """
+            v1 (CONNTABLE_BACKEND=connhash) get slow path, legacy sleep on
+            the first busy connection against the waitqueue, with fewer
+            connections than getters, compare gets/s of the two runs
+        """
+	for legacy in [1, 0]:
+		if not legacy:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_013-{}'.format(legacy), nr_nodes=1,
+			nr_conns=BASE_THREADS / 2, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS, put_delay_us=100,
+			params='legacy_slowpath={}'.format(legacy))
+
+    def test_014(self):
+        """
+            v2 tables preloaded from a topology blob through the firmware
+            loader, lookups start against a full table, the load time is
+            logged to dmesg
+        """
+	WriteTopology('{}/conntable_topo.bin'.format(FIRMWAREDIR),
+		BASE_THREADS, BASE_THREADS)
+	self.runTest('test_014', nr_nodes=BASE_THREADS, nr_conns=BASE_THREADS,
+		nr_insert_threads=1, nr_lookup_threads=BASE_THREADS,
+		put_delay_us=100, params='topology=conntable_topo.bin')
+
+    def test_015(self):
+        """
+            v2 table saved to a snapshot at rmmod and restored at the next
+            insmod, the second run starts with the pools and counters of
+            the first, the restore time is logged to dmesg
+        """
+	snap = '{}/conntable.snap'.format(OUTPUTDIR)
+	if os.path.exists(snap):
+		os.remove(snap)
+	for run in [0, 1]:
+		if run:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_015-{}'.format(run), nr_nodes=BASE_THREADS,
+			nr_conns=BASE_THREADS, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS, put_delay_us=100,
+			params='snapshot={}'.format(snap))
+
+    def test_016(self):
+        """
+            v2 direct hand-off from put to the oldest parked get, against
+            the wake up and retake of the semaphore, with fewer connections
+            than getters, compare gets/s and wake to acquire of the two runs
+        """
+	for handoff in [0, 1]:
+		if handoff:
+			RunCommand('rmmod {}'.format(TESTMODULE))
+		self.runTest('test_016-{}'.format(handoff), nr_nodes=1,
+			nr_conns=BASE_THREADS / 2, nr_insert_threads=1,
+			nr_lookup_threads=BASE_THREADS, put_delay_us=100,
+			params='handoff={}'.format(handoff))
+
 def TestDriver():
     suite = unittest.TestLoader().loadTestsFromTestCase(ConntableUnitTests)
     unittest.TextTestRunner(verbosity=2).run(suite)